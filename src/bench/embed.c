@@ -0,0 +1,117 @@
+// measures the per-evaluation overhead of embedding lispy through liblispy against running
+// the lispy executable once per evaluation, which also pays for process start and building the grammar
+//
+// usage: embed <path to lispy executable> [evaluations] [executions]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../lispy.h"
+
+#define PROGRAM "(+ 1 (* 2 3) (- 10 4))"
+
+extern char** environ;
+
+static double now()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_embedded(int evaluations, double* startup)
+{
+    double start = now();
+    lispvm* vm = lispvm_new();
+    *startup = now() - start;
+
+    start = now();
+
+    for (int i = 0; i < evaluations; i++)
+    {
+        lispvalue* lv = lispvm_eval_string(vm, PROGRAM);
+
+        if (lispvalue_as_number(lv) != 13)
+        {
+            fprintf(stderr, "unexpected result: %s\n", lispvalue_to_string(lv));
+            exit(1);
+        }
+
+        lispvalue_delete(lv);
+    }
+
+    double elapsed = now() - start;
+    lispvm_delete(vm);
+
+    return elapsed / evaluations;
+}
+
+static double bench_executed(char* lispy, int executions)
+{
+    char path[] = "/tmp/lispy-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) { perror("mkstemp"); exit(1); }
+
+    dprintf(fd, "%s\n", PROGRAM);
+    close(fd);
+
+    // the executable prints its banner and results, throw them away
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char* args[] = { lispy, path, NULL };
+    double start = now();
+
+    for (int i = 0; i < executions; i++)
+    {
+        pid_t pid;
+        int status;
+
+        if (posix_spawn(&pid, lispy, &actions, NULL, args, environ))
+        {
+            perror("posix_spawn");
+            exit(1);
+        }
+
+        waitpid(pid, &status, 0);
+    }
+
+    double elapsed = now() - start;
+
+    posix_spawn_file_actions_destroy(&actions);
+    unlink(path);
+
+    return elapsed / executions;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <path to lispy executable> [evaluations] [executions]\n", argv[0]);
+        return 1;
+    }
+
+    int evaluations = argc > 2 ? atoi(argv[2]) : 100000;
+    int executions  = argc > 3 ? atoi(argv[3]) : 200;
+
+    double startup;
+    double embedded = bench_embedded(evaluations, &startup);
+    double executed = bench_executed(argv[1], executions);
+
+    printf("program:    %s\n", PROGRAM);
+    printf("embedded:   %10.3f us per evaluation (%d evaluations, %.3f ms to create the vm)\n",
+    embedded * 1e6, evaluations, startup * 1e3);
+    printf("executed:   %10.3f us per evaluation (%d executions)\n", executed * 1e6, executions);
+    printf("speedup:    %10.1fx\n", executed / embedded);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+// measures what the mpc reader pays at startup to build its grammar, parsing the grammar with mpca_lang
+// against loading the image of it in grammar.c, and what a virtual machine's first parse costs with the image
+//
+// usage: startup [builds]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../lispy.h"
+#include "../grammar.h"
+
+#define PROGRAM "+ 1 (* 2 3) (- 10 4)"
+
+static double now()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// builds the grammar into new parsers, from its image or by parsing it, and deletes them again
+static double bench_build(int builds, int image)
+{
+    double start = now();
+
+    for (int i = 0; i < builds; i++)
+    {
+        mpc_parser_t* program         = mpc_new(PROGRAM_STR);
+        mpc_parser_t* expression      = mpc_new(EXPRESSION_STR);
+        mpc_parser_t* s_expression    = mpc_new(SEXPRESSION_STR);
+        mpc_parser_t* q_expression    = mpc_new(QEXPRESSION_STR);
+        mpc_parser_t* symbol          = mpc_new(SYMBOL_STR);
+        mpc_parser_t* number          = mpc_new(NUMBER_STR);
+
+        mpc_err_t* error = image
+            ? mpca_lang_load(MPCA_LANG_DEFAULT, LISPVM_GRAMMAR, lispvm_grammar_image, lispvm_grammar_image_length,
+              program, expression, s_expression, q_expression, symbol, number)
+            : mpca_lang(MPCA_LANG_DEFAULT, LISPVM_GRAMMAR,
+              program, expression, s_expression, q_expression, symbol, number);
+
+        if (error)
+        {
+            mpc_err_print_to(error, stderr);
+            exit(1);
+        }
+
+        mpc_cleanup(6, number, symbol, q_expression, s_expression, expression, program);
+    }
+
+    return (now() - start) / builds;
+}
+
+static double bench_first_parse(int builds)
+{
+    double start = now();
+
+    for (int i = 0; i < builds; i++)
+    {
+        lispvm* vm = lispvm_new();
+        mpc_ast_arena_t* arena = mpc_ast_arena_new();
+        mpc_result_t result;
+
+        if (!lispvm_parse(vm, "<bench>", PROGRAM, arena, &result))
+        {
+            mpc_err_print_to(result.error, stderr);
+            exit(1);
+        }
+
+        mpc_ast_arena_delete(arena);
+        lispvm_delete(vm);
+    }
+
+    return (now() - start) / builds;
+}
+
+int main(int argc, char** argv)
+{
+    int builds = argc > 1 ? atoi(argv[1]) : 2000;
+
+    double parsed = bench_build(builds, 0);
+    double loaded = bench_build(builds, 1);
+    double first  = bench_first_parse(builds);
+
+    printf("grammar:    %10.3f us per build parsing it with mpca_lang (%d builds)\n", parsed * 1e6, builds);
+    printf("image:      %10.3f us per build loading its %zu byte image\n", loaded * 1e6, lispvm_grammar_image_length);
+    printf("speedup:    %10.1fx\n", parsed / loaded);
+    printf("first parse:%10.3f us per virtual machine created to parse \"%s\"\n", first * 1e6, PROGRAM);
+
+    return 0;
+}
@@ -1,271 +1,969 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "definitions.h"
 #include "constdest.h"
 #include "evaluator.h"
+#include "pool.h"
+#include "vm.h"
+#include "channel.h"
+#include "isolate.h"
+#include "future.h"
+#include "generator.h"
+#include "promise.h"
 
 #include "builtins.h"
 
-#define LISP_ASSERT(lv, condition, format, ...)                     \
+#define LISP_ASSERT(condition, format, ...)                         \
     if (!(condition))                                               \
     {                                                               \
-        lispvalue* error = lispvalue_error(format, ##__VA_ARGS__);  \
-        lispvalue_delete(lv);                                       \
-        return error;                                               \
+        return lispvalue_error(format, ##__VA_ARGS__);              \
     }                                                               \
 
-lispvalue* builtin_define(lispenv* le, lispvalue* lv)
+#define LISP_ASSERT_ARGC(name, argc, expected)                      \
+    LISP_ASSERT((argc) == (expected),                               \
+        "function \"%s\" passed in an incorrect number of arguments: " \
+        "expected %i, got %i", name, expected, argc                 \
+    )                                                               \
+
+#define LISP_ASSERT_TYPE(name, argv, i, expected)                   \
+    LISP_ASSERT((argv)[i]->type == (expected),                      \
+        "function \"%s\" passed in an incorrect type at argument %i: " \
+        "expected %s, got %s", name, i,                             \
+        lv_type_to_name(expected), lv_type_to_name((argv)[i]->type) \
+    )                                                               \
+
+// take ownership of an argument, the caller will no longer delete it
+static lispvalue* builtin_steal(lispvalue** argv, int i)
 {
-    LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-        "function \"define\" passed in an incorrect type: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-    )
+    lispvalue* x = argv[i];
+    argv[i] = NULL;
+    return x;
+}
+
+lispvalue* builtin_define(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc > 0, "function \"define\" passed in no arguments")
 
-    lispvalue* symbols = lv->cells[0];
+    LISP_ASSERT_TYPE(DEFINE_STR, argv, 0, LISPVALUE_QEXPRESSION)
+
+    lispenv* root = le;
+    while (root->parent) root = root->parent;
+
+    LISP_ASSERT(!atomic_load(&root->shared),
+        "function \"define\" cannot define while the environment is shared between threads")
+
+    lispvalue* symbols = argv[0];
 
     for (int i = 0; i < symbols->cell_count; i++)
     {
-        LISP_ASSERT(lv, symbols->cells[i]->type == LISPVALUE_SYMBOL,
+        LISP_ASSERT(symbols->cells[i]->type == LISPVALUE_SYMBOL,
             "function \"define\" cannot define non-symbol: "
             "non-symbol number %i", i
         )
     }
 
-    LISP_ASSERT(lv, symbols->cell_count == lv->cell_count - 1,
+    LISP_ASSERT(symbols->cell_count == argc - 1,
         "function \"define\" received inconsistent number of values and symbols: "
-        "%lli symbols, %lli values",
-        symbols->cell_count, lv->cell_count - 1
+        "%lli symbols, %i values",
+        symbols->cell_count, argc - 1
     )
 
     for (int i = 0; i < symbols->cell_count; i++)
-    lispenv_define(le, symbols->cells[i]->symbol, lv->cells[i + 1]);
+    lispenv_define(le, symbols->cells[i]->symbol, argv[i + 1]);
 
-    lispvalue_delete(lv);
     return lispvalue_sexpression();
 }
 
-lispvalue* builtin_len(lispenv* le, lispvalue* lv)
+lispvalue* builtin_len(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    LISP_ASSERT(lv, lv->cells[0]->cell_count != 0,
-        "function \"len\" passed in no arguments")
+    LISP_ASSERT_ARGC(LEN_STR, argc, 1)
+    LISP_ASSERT_TYPE(LEN_STR, argv, 0, LISPVALUE_QEXPRESSION)
 
-    else LISP_ASSERT(lv, lv->cell_count == 1,
-        "function \"len\" passed in too many arguments")
+    return lispvalue_number(argv[0]->cell_count);
+}
 
-    else LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-        "function \"len\" passed in an incorrect type: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-    )
+lispvalue* builtin_list(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    lispvalue* x = lispvalue_qexpression();
+
+    // the size is known up front, so allocate the cells once and move the arguments in
+    x->cell_count = argc;
+    x->cells = malloc(sizeof(lispvalue*) * argc);
 
-    lispvalue* x = lispvalue_take(lv, 0);
+    for (int i = 0; i < argc; i++) x->cells[i] = builtin_steal(argv, i);
 
-    return lispvalue_number(x->cell_count);
+    return x;
 }
 
-lispvalue* builtin_list(lispenv* le, lispvalue* lv)
+lispvalue* builtin_head(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    lv->type = LISPVALUE_QEXPRESSION;
-    return lv;
+    LISP_ASSERT_ARGC(HEAD_STR, argc, 1)
+    LISP_ASSERT_TYPE(HEAD_STR, argv, 0, LISPVALUE_QEXPRESSION)
+
+    LISP_ASSERT(argv[0]->cell_count != 0,
+        "function \"head\" passed in an empty %s", lv_type_to_name(LISPVALUE_QEXPRESSION))
+
+    lispvalue* x = builtin_steal(argv, 0);
+
+    for (int i = 1; i < x->cell_count; i++) lispvalue_delete(x->cells[i]);
+    x->cell_count = 1;
+
+    return x;
 }
 
-lispvalue* builtin_head(lispenv* le, lispvalue* lv)
+lispvalue* builtin_tail(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    LISP_ASSERT(lv, lv->cells[0]->cell_count != 0,
-        "function \"head\" passed in no arguments")
+    LISP_ASSERT_ARGC(TAIL_STR, argc, 1)
+    LISP_ASSERT_TYPE(TAIL_STR, argv, 0, LISPVALUE_QEXPRESSION)
 
-    else LISP_ASSERT(lv, lv->cell_count == 1,
-        "function \"head\" passed in too many arguments")
+    LISP_ASSERT(argv[0]->cell_count != 0,
+        "function \"tail\" passed in an empty %s", lv_type_to_name(LISPVALUE_QEXPRESSION))
 
-    else LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-        "function \"head\" passed in an incorrect type: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-    )
+    lispvalue* x = builtin_steal(argv, 0);
 
-    lispvalue* x = lispvalue_take(lv, 0);
+    lispvalue_delete(lispvalue_pop(x, 0));
 
-    while (x->cell_count > 1) lispvalue_delete(lispvalue_pop(x, 1));
+    return x;
+}
+
+lispvalue* builtin_join(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc > 0, "function \"join\" passed in no arguments")
+
+    for (int i = 0; i < argc; i++) LISP_ASSERT_TYPE(JOIN_STR, argv, i, LISPVALUE_QEXPRESSION)
+
+    lispvalue* x = builtin_steal(argv, 0);
+
+    for (int i = 1; i < argc; i++) x = lispvalue_join(x, builtin_steal(argv, i));
 
     return x;
 }
 
-lispvalue* builtin_tail(lispenv* le, lispvalue* lv)
+lispvalue* builtin_reverse(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    LISP_ASSERT(lv, lv->cells[0]->cell_count != 0,
-        "function \"tail\" passed in no arguments")
+    LISP_ASSERT_ARGC(REVERSE_STR, argc, 1)
+    LISP_ASSERT_TYPE(REVERSE_STR, argv, 0, LISPVALUE_QEXPRESSION)
 
-    else LISP_ASSERT(lv, lv->cell_count == 1,
-        "function \"tail\" passed in too many arguments")
+    lispvalue* x = builtin_steal(argv, 0);
 
-    else LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-        "function \"tail\" passed in an incorrect type: "
+    // swap elements from both ends towards the middle
+    for (int i = 0, j = x->cell_count - 1; i < j; i++, j--)
+    {
+        lispvalue* y = x->cells[i];
+        x->cells[i] = x->cells[j];
+        x->cells[j] = y;
+    }
+
+    return x;
+}
+
+lispvalue* builtin_eval(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(EVAL_STR, argc, 1)
+    LISP_ASSERT_TYPE(EVAL_STR, argv, 0, LISPVALUE_QEXPRESSION)
+
+    // evaluate the q_expression's cells as an s_expression in place, without copying it
+    return lispvalue_eval_sexpression(vm, le, argv[0]);
+}
+
+lispvalue* builtin_lambda(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc == 2,
+        "user-defined function passed in too little/too many arguments: "
+        "expected 2, got %i", argc)
+
+    LISP_ASSERT(argv[0]->type == LISPVALUE_QEXPRESSION,
+        "user-defined function passed in an incorrect type for argument 0: "
         "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
+        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(argv[0]->type)
     )
 
-    lispvalue* x = lispvalue_take(lv, 0);
+    LISP_ASSERT(argv[1]->type == LISPVALUE_QEXPRESSION,
+        "user-defined function passed in an incorrect type for argument 1: "
+        "expected %s, got %s",
+        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(argv[1]->type)
+    )
+
+    // check the first q_expression contains only symbols
+    for (int i = 0; i < argv[0]->cell_count; i++)
+    LISP_ASSERT(argv[0]->cells[i]->type == LISPVALUE_SYMBOL,
+        "cannot operate formals on a non-symbol: "
+        "expected %s, got %s",
+        lv_type_to_name(LISPVALUE_SYMBOL), lv_type_to_name(argv[0]->cells[i]->type)
+    )
+
+    lispvalue* formals = builtin_steal(argv, 0);
+    lispvalue* body = builtin_steal(argv, 1);
+
+    return lispvalue_lambda(formals, body);
+}
+
+// calls "function" with a single argument, which it takes ownership of
+static lispvalue* builtin_call1(lispvm* vm, lispenv* le, lispvalue* function, lispvalue* x)
+{
+    lispvalue* result = lispvalue_apply(vm, le, function, 1, &x);
+    if (x) lispvalue_delete(x);
+    return result;
+}
+
+lispvalue* builtin_map(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(MAP_STR, argc, 2)
+    LISP_ASSERT_TYPE(MAP_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(MAP_STR, argv, 1, LISPVALUE_QEXPRESSION)
+
+    // each result replaces its element in the list, so the output needs no allocation of its own
+    lispvalue* x = builtin_steal(argv, 1);
+
+    for (int i = 0; i < x->cell_count; i++)
+    {
+        x->cells[i] = builtin_call1(vm, le, argv[0], x->cells[i]);
+
+        if (x->cells[i]->type == LISPVALUE_ERROR)
+        {
+            lispvalue* error = x->cells[i];
+            x->cells[i] = lispvalue_sexpression();
+            lispvalue_delete(x);
+            return error;
+        }
+    }
 
-    lispvalue_delete(lispvalue_pop(x, 0));
-    
     return x;
 }
 
-lispvalue* builtin_join(lispenv* le, lispvalue* lv)
+lispvalue* builtin_filter(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    for (int i = 0; i < lv->cell_count; i++) 
-    LISP_ASSERT(lv, lv->cells[i]->type == LISPVALUE_QEXPRESSION,
-        "function \"join\" passed in an incorrect type at argument %i: "
-        "expected %s, got %s", i,
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[i]->type)
-    )
+    LISP_ASSERT_ARGC(FILTER_STR, argc, 2)
+    LISP_ASSERT_TYPE(FILTER_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(FILTER_STR, argv, 1, LISPVALUE_QEXPRESSION)
+
+    // kept elements are compacted towards the front of the list in place
+    lispvalue* x = builtin_steal(argv, 1);
+    int kept = 0;
+
+    for (int i = 0; i < x->cell_count; i++)
+    {
+        lispvalue* keep = builtin_call1(vm, le, argv[0], lispvalue_copy(x->cells[i]));
 
-    lispvalue* x = lispvalue_pop(lv, 0);
+        if (keep->type == LISPVALUE_ERROR)
+        {
+            // the elements between "kept" and "i" were moved or deleted already
+            for (int j = i; j < x->cell_count; j++) x->cells[kept++] = x->cells[j];
+            x->cell_count = kept;
+            lispvalue_delete(x);
+            return keep;
+        }
+
+        if (lispvalue_truthy(keep)) x->cells[kept++] = x->cells[i];
+        else lispvalue_delete(x->cells[i]);
+
+        lispvalue_delete(keep);
+    }
 
-    while (lv->cell_count) x = lispvalue_join(x, lispvalue_pop(lv, 0));
+    x->cell_count = kept;
 
-    lispvalue_delete(lv);
-    
     return x;
 }
 
-lispvalue* builtin_reverse(lispenv* le, lispvalue* lv)
+lispvalue* builtin_fold(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    LISP_ASSERT(lv, lv->cells[0]->cell_count != 0,
-        "function \"reverse\" passed in no arguments")
+    LISP_ASSERT_ARGC(FOLD_STR, argc, 3)
+    LISP_ASSERT_TYPE(FOLD_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(FOLD_STR, argv, 2, LISPVALUE_QEXPRESSION)
 
-    else LISP_ASSERT(lv, lv->cell_count == 1,
-        "function \"reverse\" passed in too many arguments")
+    lispvalue* accumulator = builtin_steal(argv, 1);
+    lispvalue* x = builtin_steal(argv, 2);
 
-        else LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-            "function \"reverse\" passed in an incorrect type: "
-            "expected %s, got %s",
-            lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-        )
+    for (int i = 0; i < x->cell_count; i++)
+    {
+        // the accumulator and the element are moved into the call
+        lispvalue* args[2] = { accumulator, x->cells[i] };
+        x->cells[i] = NULL;
 
-    lispvalue* reversed = lispvalue_qexpression();
+        accumulator = lispvalue_apply(vm, le, argv[0], 2, args);
 
-    lispvalue* x = lispvalue_take(lv, 0);
+        if (args[0]) lispvalue_delete(args[0]);
+        if (args[1]) lispvalue_delete(args[1]);
 
-    while (x->cell_count)
-    reversed = lispvalue_add(reversed, lispvalue_pop(x, x->cell_count - 1));
+        if (accumulator->type == LISPVALUE_ERROR) break;
+    }
 
+    // the elements moved out above are gone, delete whatever is left
+    for (int i = 0; i < x->cell_count; i++) if (x->cells[i]) lispvalue_delete(x->cells[i]);
+    x->cell_count = 0;
     lispvalue_delete(x);
 
-    return reversed;
+    return accumulator;
 }
 
-lispvalue* builtin_eval(lispenv* le, lispvalue* lv)
+lispvalue* builtin_for_each(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
 {
-    LISP_ASSERT(lv, lv->cells[0]->cell_count != 0,
-        "function \"eval\" passed in no arguments")
+    LISP_ASSERT_ARGC(FOR_EACH_STR, argc, 2)
+    LISP_ASSERT_TYPE(FOR_EACH_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(FOR_EACH_STR, argv, 1, LISPVALUE_QEXPRESSION)
 
-    else LISP_ASSERT(lv, lv->cell_count == 1, 
-        "function \"eval\" passed in too many arguments")
-    
-    else LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-        "function \"eval\" passed in an incorrect type: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-    )
+    lispvalue* x = builtin_steal(argv, 1);
+    lispvalue* result = NULL;
 
-    lispvalue* x = lispvalue_take(lv, 0);
-    x->type = LISPVALUE_SEXPRESSION;
-    return lispvalue_eval(le, x);
+    // elements are moved into the calls one by one
+    for (int i = 0; i < x->cell_count; i++)
+    {
+        lispvalue* y = x->cells[i];
+        x->cells[i] = NULL;
+
+        if (result) lispvalue_delete(y);
+        else
+        {
+            result = builtin_call1(vm, le, argv[0], y);
+
+            if (result->type == LISPVALUE_ERROR) continue;
+
+            lispvalue_delete(result);
+            result = NULL;
+        }
+    }
+
+    x->cell_count = 0;
+    lispvalue_delete(x);
+
+    return result ? result : lispvalue_sexpression();
 }
 
-lispvalue* builtin_lambda(lispenv* le, lispvalue* lv)
+struct paralleltask;
+
+// state shared by every chunk of a parallel builtin
+typedef struct parallelstate
 {
-    LISP_ASSERT(lv, lv->cells[0]->cell_count != 0,
-        "user-defined function passed in no arguments")
+    lispvm* vm;
+    lispenv* le;
+    lispvalue* function;
+    lispvalue* identity;
+    lispvalue** cells;
+    char* keep;
+    int64_t cutoff;
+
+    // set once any chunk fails, so the rest stop early
+    atomic_int failed;
+
+    void (*leaf)(struct paralleltask* t);
+    void (*combine)(struct paralleltask* t, struct paralleltask* right);
+} parallelstate;
+
+// a chunk of the cells array, split in half and forked until it is below the cutoff
+typedef struct paralleltask
+{
+    lisptask task;
+    parallelstate* state;
+    int64_t lo;
+    int64_t hi;
 
-    else LISP_ASSERT(lv, lv->cells[0]->cell_count == 2,
-        "user-defined function passed in too little/too many arguments")
+    // the error raised by this chunk, or the reduced value for "preduce"
+    lispvalue* result;
+} paralleltask;
 
-    else LISP_ASSERT(lv, lv->cells[0]->type == LISPVALUE_QEXPRESSION,
-        "user-defined function passed in an incorrect type for argument 0: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-    )
+static void parallel_run(lisptask* task)
+{
+    paralleltask* t = (paralleltask*)task;
+    parallelstate* s = t->state;
 
-    else LISP_ASSERT(lv, lv->cells[1]->type == LISPVALUE_QEXPRESSION,
-        "user-defined function passed in an incorrect type for argument 1: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(lv->cells[0]->type)
-    )
+    if (t->hi - t->lo <= s->cutoff)
+    {
+        s->leaf(t);
+        return;
+    }
 
-    // check the first q_expression contains only symbols
-    for (int i = 0; i < lv->cells[0]->cell_count; i++)
-    LISP_ASSERT(lv, lv->cells[0]->cells[i]->type == LISPVALUE_SYMBOL,
-        "cannot operate formals on a non-symbol: "
-        "expected %s, got %s",
-        lv_type_to_name(LISPVALUE_SYMBOL), lv_type_to_name(lv->cells[0]->cells[i]->type)
-    )
+    paralleltask right = { .state = s, .lo = t->lo + (t->hi - t->lo) / 2, .hi = t->hi, .result = NULL };
+    right.task.run = parallel_run;
+    t->hi = right.lo;
+
+    lisppool_fork(&right.task);
+    parallel_run(&t->task);
+    lisppool_join(&right.task);
 
-    lispvalue* formals = lispvalue_pop(lv, 0);
-    lispvalue* body = lispvalue_pop(lv, 0);
+    s->combine(t, &right);
+}
 
-    lispvalue_delete(lv);
+// runs "s" over "count" cells on the shared pool, returning the root chunk's result,
+// the environment is marked shared for the duration so nothing can be defined into it
+static lispvalue* parallel_start(parallelstate* s, int64_t count)
+{
+    lispenv* root = s->le;
+    while (root->parent) root = root->parent;
 
-    return lispvalue_lambda(formals, body);
+    atomic_init(&s->failed, 0);
+
+    paralleltask t = { .state = s, .lo = 0, .hi = count, .result = NULL };
+    t.task.run = parallel_run;
+
+    // the pool is held until the tasks are done, resizing meanwhile only swaps in another one for later calls
+    lisppool* pool = lispvm_pool(s->vm);
+
+    atomic_fetch_add(&root->shared, 1);
+    lisppool_run(pool, &t.task);
+    atomic_fetch_sub(&root->shared, 1);
+
+    lisppool_delete(pool);
+
+    return t.result;
 }
 
-lispvalue* lispvalue_join(lispvalue* lv, lispvalue* new_lv)
+// keeps the left chunk's error, or the right one's if the left succeeded
+static void parallel_combine_error(paralleltask* t, paralleltask* right)
 {
-    while (new_lv->cell_count) lv = lispvalue_add(lv, lispvalue_pop(new_lv, 0));
-    lispvalue_delete(new_lv);
-    return lv;
+    if (!t->result) t->result = right->result;
+    else if (right->result) lispvalue_delete(right->result);
 }
 
-lispvalue* builtin_add(lispenv* le, lispvalue* lv) { return builtin_operator(le, lv, ADD_SYMBOL_STR); }
-lispvalue* builtin_sub(lispenv* le, lispvalue* lv) { return builtin_operator(le, lv, SUB_SYMBOL_STR); }
-lispvalue* builtin_mul(lispenv* le, lispvalue* lv) { return builtin_operator(le, lv, MUL_SYMBOL_STR); }
-lispvalue* builtin_div(lispenv* le, lispvalue* lv) { return builtin_operator(le, lv, DIV_SYMBOL_STR); }
-lispvalue* builtin_rem(lispenv* le, lispvalue* lv) { return builtin_operator(le, lv, REM_SYMBOL_STR); }
+static void parallel_map_leaf(paralleltask* t)
+{
+    parallelstate* s = t->state;
+
+    for (int64_t i = t->lo; i < t->hi && !atomic_load_explicit(&s->failed, memory_order_relaxed); i++)
+    {
+        s->cells[i] = builtin_call1(s->vm, s->le, s->function, s->cells[i]);
+
+        if (s->cells[i]->type == LISPVALUE_ERROR)
+        {
+            t->result = s->cells[i];
+            s->cells[i] = lispvalue_sexpression();
+            atomic_store_explicit(&s->failed, 1, memory_order_relaxed);
+        }
+    }
+}
 
-lispvalue* builtin_operator(lispenv* le, lispvalue* lv, char* op)
+static void parallel_filter_leaf(paralleltask* t)
 {
-    // ensures all elements are numbers
-    for (int i = 0; i < lv->cell_count; i++)
+    parallelstate* s = t->state;
+
+    for (int64_t i = t->lo; i < t->hi && !atomic_load_explicit(&s->failed, memory_order_relaxed); i++)
     {
-        if (lv->cells[i]->type != LISPVALUE_NUMBER) 
+        lispvalue* keep = builtin_call1(s->vm, s->le, s->function, lispvalue_copy(s->cells[i]));
+
+        if (keep->type == LISPVALUE_ERROR)
         {
-            lispvalue_delete(lv);
-            return lispvalue_error("cannot operate on non-number");
+            t->result = keep;
+            atomic_store_explicit(&s->failed, 1, memory_order_relaxed);
+            break;
         }
+
+        s->keep[i] = lispvalue_truthy(keep);
+        lispvalue_delete(keep);
     }
+}
 
-    lispvalue* x = lispvalue_pop(lv, 0);
+// calls the reducing function on two values it takes ownership of
+static lispvalue* parallel_reduce_call(parallelstate* s, lispvalue* x, lispvalue* y)
+{
+    lispvalue* args[2] = { x, y };
+    lispvalue* result = lispvalue_apply(s->vm, s->le, s->function, 2, args);
 
-    // perform unary negation
-    if (!strcmp(op, SUB_SYMBOL_STR) && lv->cell_count == 0) x->number = -x->number;
+    if (args[0]) lispvalue_delete(args[0]);
+    if (args[1]) lispvalue_delete(args[1]);
 
-    // perform operations on the rest of the elements
-    while (lv->cell_count > 0)
+    if (result->type == LISPVALUE_ERROR) atomic_store_explicit(&s->failed, 1, memory_order_relaxed);
+
+    return result;
+}
+
+static void parallel_reduce_leaf(paralleltask* t)
+{
+    parallelstate* s = t->state;
+
+    t->result = lispvalue_copy(s->identity);
+
+    for (int64_t i = t->lo; i < t->hi && t->result->type != LISPVALUE_ERROR; i++)
     {
-        lispvalue* y = lispvalue_pop(lv, 0);
+        if (atomic_load_explicit(&s->failed, memory_order_relaxed)) break;
+
+        lispvalue* x = s->cells[i];
+        s->cells[i] = NULL;
+
+        t->result = parallel_reduce_call(s, t->result, x);
+    }
+}
+
+static void parallel_reduce_combine(paralleltask* t, paralleltask* right)
+{
+    if (t->result->type == LISPVALUE_ERROR) lispvalue_delete(right->result);
+    else if (right->result->type == LISPVALUE_ERROR)
+    {
+        lispvalue_delete(t->result);
+        t->result = right->result;
+    }
+
+    else t->result = parallel_reduce_call(t->state, t->result, right->result);
+}
+
+// reads the optional cutoff argument at index "i"
+static int64_t parallel_cutoff(int argc, lispvalue** argv, int i)
+{
+    if (argc <= i) return PARALLEL_CUTOFF;
+    return argv[i]->number > 0 ? argv[i]->number : 1;
+}
+
+lispvalue* builtin_pmap(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc == 2 || argc == 3,
+        "function \"pmap\" passed in an incorrect number of arguments: "
+        "expected 2 or 3, got %i", argc)
+    LISP_ASSERT_TYPE(PMAP_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(PMAP_STR, argv, 1, LISPVALUE_QEXPRESSION)
+    if (argc == 3) LISP_ASSERT_TYPE(PMAP_STR, argv, 2, LISPVALUE_NUMBER)
+
+    // like "map" each result replaces its element, chunks write to disjoint parts of the cells
+    lispvalue* x = builtin_steal(argv, 1);
+
+    parallelstate s = {
+        .vm = vm, .le = le, .function = argv[0], .cells = x->cells, .cutoff = parallel_cutoff(argc, argv, 2),
+        .leaf = parallel_map_leaf, .combine = parallel_combine_error
+    };
+
+    lispvalue* error = parallel_start(&s, x->cell_count);
+
+    if (error)
+    {
+        lispvalue_delete(x);
+        return error;
+    }
+
+    return x;
+}
 
-        if (!strcmp(op, ADD_SYMBOL_STR)) x->number += y->number;
-        else if (!strcmp(op, SUB_SYMBOL_STR)) x->number -= y->number;
-        else if (!strcmp(op, MUL_SYMBOL_STR)) x->number *= y->number;
-        else if (!strcmp(op, DIV_SYMBOL_STR))
+lispvalue* builtin_pfilter(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc == 2 || argc == 3,
+        "function \"pfilter\" passed in an incorrect number of arguments: "
+        "expected 2 or 3, got %i", argc)
+    LISP_ASSERT_TYPE(PFILTER_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(PFILTER_STR, argv, 1, LISPVALUE_QEXPRESSION)
+    if (argc == 3) LISP_ASSERT_TYPE(PFILTER_STR, argv, 2, LISPVALUE_NUMBER)
+
+    // the predicate runs in parallel, compacting the kept elements afterwards is sequential
+    lispvalue* x = builtin_steal(argv, 1);
+    char* keep = calloc(x->cell_count ? x->cell_count : 1, 1);
+
+    parallelstate s = {
+        .vm = vm, .le = le, .function = argv[0], .cells = x->cells, .keep = keep,
+        .cutoff = parallel_cutoff(argc, argv, 2),
+        .leaf = parallel_filter_leaf, .combine = parallel_combine_error
+    };
+
+    lispvalue* error = parallel_start(&s, x->cell_count);
+
+    if (error)
+    {
+        free(keep);
+        lispvalue_delete(x);
+        return error;
+    }
+
+    int64_t kept = 0;
+
+    for (int64_t i = 0; i < x->cell_count; i++)
+    {
+        if (keep[i]) x->cells[kept++] = x->cells[i];
+        else lispvalue_delete(x->cells[i]);
+    }
+
+    x->cell_count = kept;
+    free(keep);
+
+    return x;
+}
+
+lispvalue* builtin_preduce(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc == 3 || argc == 4,
+        "function \"preduce\" passed in an incorrect number of arguments: "
+        "expected 3 or 4, got %i", argc)
+    LISP_ASSERT_TYPE(PREDUCE_STR, argv, 0, LISPVALUE_FUNCTION)
+    LISP_ASSERT_TYPE(PREDUCE_STR, argv, 2, LISPVALUE_QEXPRESSION)
+    if (argc == 4) LISP_ASSERT_TYPE(PREDUCE_STR, argv, 3, LISPVALUE_NUMBER)
+
+    // every chunk starts from its own copy of the identity and chunks are combined with the
+    // function itself, so the function must be associative and the identity its identity element
+    lispvalue* x = builtin_steal(argv, 2);
+
+    parallelstate s = {
+        .vm = vm, .le = le, .function = argv[0], .identity = argv[1], .cells = x->cells,
+        .cutoff = parallel_cutoff(argc, argv, 3),
+        .leaf = parallel_reduce_leaf, .combine = parallel_reduce_combine
+    };
+
+    lispvalue* result = parallel_start(&s, x->cell_count);
+
+    // elements moved into calls are gone, delete whatever is left
+    for (int64_t i = 0; i < x->cell_count; i++) if (x->cells[i]) lispvalue_delete(x->cells[i]);
+    x->cell_count = 0;
+    lispvalue_delete(x);
+
+    return result;
+}
+
+lispvalue* builtin_workers(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(WORKERS_STR, argc, 1)
+    LISP_ASSERT_TYPE(WORKERS_STR, argv, 0, LISPVALUE_NUMBER)
+
+    // zero asks for the current number of workers without changing it
+    if (argv[0]->number <= 0)
+    {
+        lisppool* pool = lispvm_pool(vm);
+        int worker_count = lisppool_worker_count(pool);
+        lisppool_delete(pool);
+
+        return lispvalue_number(worker_count);
+    }
+
+    return lispvalue_number(lisppool_configure(argv[0]->number));
+}
+
+// values handed to another thread are transferred to it, fail instead of
+// letting one that cannot be used there turn into an error on the way
+static lispvalue* builtin_check_transfer(char* name, int argc, lispvalue** argv)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        lispvalue* x = lispvalue_untransferable(argv[i]);
+
+        if (x) return lispvalue_error("function \"%s\" cannot pass a %s to another thread at argument %i",
+        name, lv_type_to_name(x->type), i);
+    }
+
+    return NULL;
+}
+
+lispvalue* builtin_spawn(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc > 0, "function \"spawn\" passed in no arguments")
+    LISP_ASSERT_TYPE(SPAWN_STR, argv, 0, LISPVALUE_FUNCTION)
+
+    lispvalue* error = builtin_check_transfer(SPAWN_STR, argc, argv);
+    if (error) return error;
+
+    lispisolate* i = lispisolate_spawn(le, argv[0], argc - 1, argv + 1);
+    LISP_ASSERT(i, "function \"spawn\" could not start a thread")
+
+    return lispvalue_isolate(i);
+}
+
+lispvalue* builtin_wait(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(WAIT_STR, argc, 1)
+    LISP_ASSERT_TYPE(WAIT_STR, argv, 0, LISPVALUE_ISOLATE)
+
+    return lispisolate_wait(argv[0]->isolate);
+}
+
+lispvalue* builtin_channel(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(CHANNEL_STR, argc, 1)
+    LISP_ASSERT_TYPE(CHANNEL_STR, argv, 0, LISPVALUE_NUMBER)
+    LISP_ASSERT(argv[0]->number > 0 && argv[0]->number <= (1 << 24),
+        "function \"channel\" passed in a capacity out of range: %lli", argv[0]->number)
+
+    return lispvalue_channel(lispchannel_new(argv[0]->number));
+}
+
+lispvalue* builtin_send(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(SEND_STR, argc, 2)
+    LISP_ASSERT_TYPE(SEND_STR, argv, 0, LISPVALUE_CHANNEL)
+
+    lispvalue* error = builtin_check_transfer(SEND_STR, argc, argv);
+    if (error) return error;
+
+    // the receiver may be another isolate, so it gets a value sharing nothing with this one
+    lispvalue* x = lispvalue_transfer(argv[1]);
+
+    if (!lispchannel_send(argv[0]->channel, x))
+    {
+        lispvalue_delete(x);
+        return lispvalue_error("function \"send\" cannot send on a closed channel");
+    }
+
+    return lispvalue_sexpression();
+}
+
+lispvalue* builtin_receive(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(RECEIVE_STR, argc, 1)
+    LISP_ASSERT_TYPE(RECEIVE_STR, argv, 0, LISPVALUE_CHANNEL)
+
+    lispvalue* x = lispchannel_receive(argv[0]->channel);
+    LISP_ASSERT(x, "function \"recv\" cannot receive from a closed channel")
+
+    return x;
+}
+
+lispvalue* builtin_close(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(CLOSE_STR, argc, 1)
+    LISP_ASSERT_TYPE(CLOSE_STR, argv, 0, LISPVALUE_CHANNEL)
+
+    lispchannel_close(argv[0]->channel);
+    return lispvalue_sexpression();
+}
+
+lispvalue* builtin_future(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc > 0, "function \"future\" passed in no arguments")
+    LISP_ASSERT_TYPE(FUTURE_STR, argv, 0, LISPVALUE_FUNCTION)
+
+    lispvalue* error = builtin_check_transfer(FUTURE_STR, argc, argv);
+    if (error) return error;
+
+    return lispvalue_future(lispfuture_start(vm, le, argv[0], argc - 1, argv + 1));
+}
+
+lispvalue* builtin_await(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(AWAIT_STR, argc, 1)
+    LISP_ASSERT_TYPE(AWAIT_STR, argv, 0, LISPVALUE_FUTURE)
+
+    return lispfuture_await(argv[0]->future);
+}
+
+lispvalue* builtin_generator(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc > 0, "function \"generator\" passed in no arguments")
+    LISP_ASSERT_TYPE(GENERATOR_STR, argv, 0, LISPVALUE_FUNCTION)
+
+    lispgenerator* g = lispgenerator_new(vm, le, argv[0], argc - 1, argv + 1);
+    LISP_ASSERT(g, "function \"generator\" cannot allocate a stack")
+
+    return lispvalue_generator(g);
+}
+
+lispvalue* builtin_yield(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(YIELD_STR, argc, 1)
+
+    lispvalue* x = lispgenerator_yield(builtin_steal(argv, 0));
+    LISP_ASSERT(x, "function \"yield\" called outside a generator")
+
+    return x;
+}
+
+lispvalue* builtin_next(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(NEXT_STR, argc, 1)
+    LISP_ASSERT_TYPE(NEXT_STR, argv, 0, LISPVALUE_GENERATOR)
+
+    return lispgenerator_next(argv[0]->generator);
+}
+
+lispvalue* builtin_done(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(DONE_STR, argc, 1)
+    LISP_ASSERT_TYPE(DONE_STR, argv, 0, LISPVALUE_GENERATOR)
+
+    int done = lispgenerator_done(argv[0]->generator);
+    LISP_ASSERT(done != -2, "function \"done\" called on a generator made by another thread")
+    LISP_ASSERT(done != -1, "function \"done\" called on a generator from inside itself")
+
+    return lispvalue_number(done);
+}
+
+lispvalue* builtin_force(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(FORCE_STR, argc, 1)
+
+    return lispvalue_force(vm, argv[0]);
+}
+
+lispvalue* builtin_lazy_range(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT(argc >= 1 && argc <= 3,
+        "function \"lazy-range\" passed in an incorrect number of arguments: "
+        "expected 1 to 3, got %i", argc)
+
+    for (int i = 0; i < argc; i++) LISP_ASSERT_TYPE(LAZY_RANGE_STR, argv, i, LISPVALUE_NUMBER)
+
+    // with only a start the sequence never ends
+    int64_t step = argc == 3 ? argv[2]->number : 1;
+    LISP_ASSERT(step, "function \"lazy-range\" passed in a step of zero")
+
+    int64_t end = argc >= 2 ? argv[1]->number : 0;
+    return lispvalue_promise(lisppromise_range(argv[0]->number, end, step, argc >= 2));
+}
+
+lispvalue* builtin_lazy_map(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(LAZY_MAP_STR, argc, 2)
+    LISP_ASSERT_TYPE(LAZY_MAP_STR, argv, 0, LISPVALUE_FUNCTION)
+
+    return lispvalue_promise(lisppromise_map(le, argv[0], argv[1]));
+}
+
+lispvalue* builtin_take(lispvm* vm, lispenv* le, int argc, lispvalue** argv)
+{
+    LISP_ASSERT_ARGC(TAKE_STR, argc, 2)
+    LISP_ASSERT_TYPE(TAKE_STR, argv, 0, LISPVALUE_NUMBER)
+
+    int64_t count = argv[0]->number;
+    lispvalue* sequence = argv[1];
+
+    // generators are taken from in place, like lazy sequences they only produce what is taken
+    if (sequence->type == LISPVALUE_GENERATOR)
+    {
+        lispvalue* taken = lispvalue_qexpression();
+
+        for (int64_t i = 0; i < count; i++)
         {
-            if (!y->number)
+            int done = lispgenerator_done(sequence->generator);
+
+            if (done < 0)
+            {
+                lispvalue_delete(taken);
+                return lispvalue_error(done == -2
+                    ? "function \"take\" called on a generator made by another thread"
+                    : "function \"take\" called on a generator from inside itself");
+            }
+
+            if (done) break;
+
+            lispvalue* x = lispgenerator_next(sequence->generator);
+
+            if (x->type == LISPVALUE_ERROR)
             {
-                lispvalue_delete(x); lispvalue_delete(y);
-                x = lispvalue_error("division by zero"); break;
+                lispvalue_delete(taken);
+                return x;
             }
 
-            x->number /= y->number;
+            lispvalue_add(taken, x);
         }
 
-        else if (!strcmp(op, REM_SYMBOL_STR)) x->number %= y->number;
-    
-        lispvalue_delete(y);
+        return taken;
     }
 
-    lispvalue_delete(lv);
-    
-    return x;
-}
\ No newline at end of file
+    return lisppromise_take(vm, sequence, count);
+}
+
+lispvalue* lispvalue_join(lispvalue* lv, lispvalue* new_lv)
+{
+    // grow the cells once and move the other list's elements across in bulk
+    lv->cells = realloc(lv->cells, sizeof(lispvalue*) * (lv->cell_count + new_lv->cell_count));
+    memcpy(&lv->cells[lv->cell_count], new_lv->cells, sizeof(lispvalue*) * new_lv->cell_count);
+    lv->cell_count += new_lv->cell_count;
+
+    // the elements now belong to "lv", so only free the other list itself
+    free(new_lv->cells);
+    free(new_lv);
+
+    return lv;
+}
+
+lispvalue* builtin_add(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_operator(vm, le, argc, argv, ADD); }
+lispvalue* builtin_sub(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_operator(vm, le, argc, argv, SUB); }
+lispvalue* builtin_mul(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_operator(vm, le, argc, argv, MUL); }
+lispvalue* builtin_div(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_operator(vm, le, argc, argv, DIV); }
+lispvalue* builtin_rem(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_operator(vm, le, argc, argv, REM); }
+
+lispvalue* builtin_operator(lispvm* vm, lispenv* le, int argc, lispvalue** argv, int op)
+{
+    LISP_ASSERT(argc > 0, "cannot operate on no arguments")
+
+    // ensures all elements are numbers
+    for (int i = 0; i < argc; i++)
+    LISP_ASSERT(argv[i]->type == LISPVALUE_NUMBER, "cannot operate on non-number")
+
+    int64_t x = argv[0]->number;
+
+    // perform unary negation
+    if (op == SUB && argc == 1) x = -x;
+
+    // perform operations on the rest of the elements
+    for (int i = 1; i < argc; i++)
+    {
+        int64_t y = argv[i]->number;
+
+        switch (op)
+        {
+            case ADD: x += y; break;
+            case SUB: x -= y; break;
+            case MUL: x *= y; break;
+            case DIV:
+                LISP_ASSERT(y, "division by zero")
+                x /= y;
+                break;
+            case REM:
+                LISP_ASSERT(y, "division by zero")
+                x %= y;
+                break;
+        }
+    }
+
+    return lispvalue_number(x);
+}
+
+lispvalue* builtin_eq(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_compare(vm, le, argc, argv, EQ); }
+lispvalue* builtin_ne(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_compare(vm, le, argc, argv, NE); }
+lispvalue* builtin_lt(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_compare(vm, le, argc, argv, LT); }
+lispvalue* builtin_gt(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_compare(vm, le, argc, argv, GT); }
+lispvalue* builtin_le(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_compare(vm, le, argc, argv, LE); }
+lispvalue* builtin_ge(lispvm* vm, lispenv* le, int argc, lispvalue** argv) { return builtin_compare(vm, le, argc, argv, GE); }
+
+lispvalue* builtin_compare(lispvm* vm, lispenv* le, int argc, lispvalue** argv, int op)
+{
+    LISP_ASSERT(argc == 2,
+        "cannot compare %i arguments: expected 2", argc)
+
+    // equality works on any type, ordering only on numbers
+    if (op == EQ) return lispvalue_number(lispvalue_equal(argv[0], argv[1]));
+    if (op == NE) return lispvalue_number(!lispvalue_equal(argv[0], argv[1]));
+
+    LISP_ASSERT(argv[0]->type == LISPVALUE_NUMBER && argv[1]->type == LISPVALUE_NUMBER,
+        "cannot compare non-number")
+
+    int64_t x = argv[0]->number;
+    int64_t y = argv[1]->number;
+
+    switch (op)
+    {
+        case LT: return lispvalue_number(x < y);
+        case GT: return lispvalue_number(x > y);
+        case LE: return lispvalue_number(x <= y);
+        default: return lispvalue_number(x >= y);
+    }
+}
+
+int lispvalue_equal(lispvalue* x, lispvalue* y)
+{
+    if (x->type != y->type) return 0;
+
+    switch (x->type)
+    {
+        case LISPVALUE_NUMBER: return x->number == y->number;
+        case LISPVALUE_ERROR:  return !strcmp(x->error, y->error);
+        case LISPVALUE_SYMBOL: return !strcmp(x->symbol, y->symbol);
+
+        // builtins are equal if they run the same function,
+        // user-defined functions if they share their code and have equal formals and body
+        case LISPVALUE_FUNCTION:
+            if (!x->code || !y->code)
+            return x->builtin == y->builtin && x->primitive == y->primitive;
+
+            return lispvalue_equal(x->code->formals, y->code->formals)
+                && lispvalue_equal(x->code->body, y->code->body);
+
+        case LISPVALUE_SEXPRESSION:
+        case LISPVALUE_QEXPRESSION:
+            if (x->cell_count != y->cell_count) return 0;
+
+            for (int i = 0; i < x->cell_count; i++)
+            if (!lispvalue_equal(x->cells[i], y->cells[i])) return 0;
+
+            return 1;
+
+        // channels, isolates, futures, generators and promises are only equal to copies of themselves
+        case LISPVALUE_CHANNEL:     return x->channel == y->channel;
+        case LISPVALUE_ISOLATE:     return x->isolate == y->isolate;
+        case LISPVALUE_FUTURE:      return x->future == y->future;
+        case LISPVALUE_GENERATOR:   return x->generator == y->generator;
+        case LISPVALUE_PROMISE:     return x->promise == y->promise;
+    }
+
+    return 0;
+}
@@ -2,23 +2,64 @@
 
 #include "definitions.h"
 
-lispvalue* builtin_define(lispenv* le, lispvalue* lv);
+lispvalue* builtin_define(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
 
-lispvalue* builtin_len(lispenv* le, lispvalue* lv);
-lispvalue* builtin_list(lispenv* le, lispvalue* lv);
-lispvalue* builtin_head(lispenv* le, lispvalue* lv);
-lispvalue* builtin_tail(lispenv* le, lispvalue* lv);
-lispvalue* builtin_join(lispenv* le, lispvalue* lv);
-lispvalue* builtin_reverse(lispenv* le, lispvalue* lv);
-lispvalue* builtin_eval(lispenv* le, lispvalue* lv);
-lispvalue* builtin_lambda(lispenv* le, lispvalue* lv);
+lispvalue* builtin_len(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_list(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_head(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_tail(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_join(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_reverse(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_eval(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_lambda(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_map(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_filter(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_fold(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_for_each(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_pmap(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_pfilter(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_preduce(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_workers(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_spawn(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_wait(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_channel(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_send(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_receive(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_close(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_future(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_await(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_generator(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_yield(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_next(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_done(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_force(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_lazy_range(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_lazy_map(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_take(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
 
 lispvalue* lispvalue_join(lispvalue* lv, lispvalue* new_lv);
 
-lispvalue* builtin_add(lispenv* le, lispvalue* lv);
-lispvalue* builtin_sub(lispenv* le, lispvalue* lv);
-lispvalue* builtin_mul(lispenv* le, lispvalue* lv);
-lispvalue* builtin_div(lispenv* le, lispvalue* lv);
-lispvalue* builtin_rem(lispenv* le, lispvalue* lv);
+lispvalue* builtin_add(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_sub(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_mul(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_div(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_rem(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_operator(lispvm* vm, lispenv* le, int argc, lispvalue** argv, int op);
+
+lispvalue* builtin_eq(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_ne(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_lt(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_gt(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_le(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+lispvalue* builtin_ge(lispvm* vm, lispenv* le, int argc, lispvalue** argv);
+
+lispvalue* builtin_compare(lispvm* vm, lispenv* le, int argc, lispvalue** argv, int op);
 
-lispvalue* builtin_operator(lispenv* le, lispvalue* lv, char* op);
\ No newline at end of file
+int lispvalue_equal(lispvalue* x, lispvalue* y);
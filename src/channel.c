@@ -0,0 +1,196 @@
+#include <stdlib.h>
+
+#include "constdest.h"
+
+#include "channel.h"
+
+// how many times to retry a full or empty channel before going to sleep
+#define CHANNEL_SPINS 64
+
+lispchannel* lispchannel_new(int64_t capacity)
+{
+    size_t size = 2;
+    while ((int64_t)size < capacity) size *= 2;
+
+    lispchannel* c = aligned_alloc(_Alignof(lispchannel), sizeof(lispchannel));
+    atomic_init(&c->refs, 1);
+
+    c->mask = size - 1;
+    c->slots = malloc(sizeof(lispchannelslot) * size);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        atomic_init(&c->slots[i].sequence, i);
+        c->slots[i].value = NULL;
+    }
+
+    atomic_init(&c->enqueue, 0);
+    atomic_init(&c->dequeue, 0);
+    atomic_init(&c->closed, 0);
+
+    atomic_init(&c->waiting, 0);
+    mtx_init(&c->lock, mtx_plain);
+    cnd_init(&c->changed);
+
+    return c;
+}
+
+void lispchannel_delete(lispchannel* c)
+{
+    if (atomic_fetch_sub_explicit(&c->refs, 1, memory_order_acq_rel) != 1) return;
+
+    // nobody else can see the channel any more, so delete whatever was never received
+    size_t dequeue = atomic_load_explicit(&c->dequeue, memory_order_relaxed);
+    size_t enqueue = atomic_load_explicit(&c->enqueue, memory_order_relaxed);
+
+    for (; dequeue != enqueue; dequeue++) lispvalue_delete(c->slots[dequeue & c->mask].value);
+
+    cnd_destroy(&c->changed);
+    mtx_destroy(&c->lock);
+    free(c->slots);
+    free(c);
+}
+
+static int lispchannel_try_send(lispchannel* c, lispvalue* lv)
+{
+    size_t position = atomic_load_explicit(&c->enqueue, memory_order_relaxed);
+
+    for (;;)
+    {
+        lispchannelslot* slot = &c->slots[position & c->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        // the slot is free for this lap, claim it by moving the enqueue position on
+        if (!difference)
+        {
+            if (atomic_compare_exchange_weak_explicit(&c->enqueue, &position, position + 1,
+                memory_order_relaxed, memory_order_relaxed))
+            {
+                slot->value = lv;
+                atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+                return 1;
+            }
+        }
+
+        // the slot still holds last lap's value, so the channel is full
+        else if (difference < 0) return 0;
+
+        // another producer claimed the slot first
+        else position = atomic_load_explicit(&c->enqueue, memory_order_relaxed);
+    }
+}
+
+static lispvalue* lispchannel_try_receive(lispchannel* c)
+{
+    size_t position = atomic_load_explicit(&c->dequeue, memory_order_relaxed);
+
+    for (;;)
+    {
+        lispchannelslot* slot = &c->slots[position & c->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+        // the slot has been written this lap, claim it and free it for the next one
+        if (!difference)
+        {
+            if (atomic_compare_exchange_weak_explicit(&c->dequeue, &position, position + 1,
+                memory_order_relaxed, memory_order_relaxed))
+            {
+                lispvalue* lv = slot->value;
+                atomic_store_explicit(&slot->sequence, position + c->mask + 1, memory_order_release);
+                return lv;
+            }
+        }
+
+        // nothing has been written to the slot yet, so the channel is empty
+        else if (difference < 0) return NULL;
+
+        else position = atomic_load_explicit(&c->dequeue, memory_order_relaxed);
+    }
+}
+
+// wakes sleepers after a successful send or receive, the fence pairs with the one in "lispchannel_sleep"
+// so either the sleeper sees the change before sleeping or this sees the sleeper
+static void lispchannel_notify(lispchannel* c)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!atomic_load_explicit(&c->waiting, memory_order_relaxed)) return;
+
+    mtx_lock(&c->lock);
+    cnd_broadcast(&c->changed);
+    mtx_unlock(&c->lock);
+}
+
+int lispchannel_send(lispchannel* c, lispvalue* lv)
+{
+    for (int i = 0; i < CHANNEL_SPINS; i++)
+    {
+        if (atomic_load_explicit(&c->closed, memory_order_acquire)) return 0;
+
+        if (lispchannel_try_send(c, lv))
+        {
+            lispchannel_notify(c);
+            return 1;
+        }
+
+        thrd_yield();
+    }
+
+    // the channel stays full, so sleep until a receiver makes room
+    mtx_lock(&c->lock);
+    atomic_fetch_add(&c->waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int sent = 0;
+    while (!atomic_load(&c->closed) && !(sent = lispchannel_try_send(c, lv)))
+    cnd_wait(&c->changed, &c->lock);
+
+    atomic_fetch_sub(&c->waiting, 1);
+    mtx_unlock(&c->lock);
+
+    if (sent) lispchannel_notify(c);
+    return sent;
+}
+
+lispvalue* lispchannel_receive(lispchannel* c)
+{
+    lispvalue* lv;
+
+    for (int i = 0; i < CHANNEL_SPINS; i++)
+    {
+        if ((lv = lispchannel_try_receive(c)))
+        {
+            lispchannel_notify(c);
+            return lv;
+        }
+
+        if (atomic_load_explicit(&c->closed, memory_order_acquire)) break;
+        thrd_yield();
+    }
+
+    // the channel stays empty, so sleep until a sender fills it or it is closed,
+    // values sent before it was closed are still received
+    mtx_lock(&c->lock);
+    atomic_fetch_add(&c->waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!(lv = lispchannel_try_receive(c)) && !atomic_load(&c->closed))
+    cnd_wait(&c->changed, &c->lock);
+
+    atomic_fetch_sub(&c->waiting, 1);
+    mtx_unlock(&c->lock);
+
+    if (lv) lispchannel_notify(c);
+    return lv;
+}
+
+void lispchannel_close(lispchannel* c)
+{
+    atomic_store(&c->closed, 1);
+
+    mtx_lock(&c->lock);
+    cnd_broadcast(&c->changed);
+    mtx_unlock(&c->lock);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "definitions.h"
+
+// a slot of a channel's ring, its sequence number says whether it is ready to be written or read
+typedef struct lispchannelslot
+{
+    atomic_size_t sequence;
+    lispvalue* value;
+} lispchannelslot;
+
+// bounded multi-producer multi-consumer queue of values passed between isolates (Vyukov's queue),
+// sending and receiving are lock-free, the lock is only taken to sleep once the channel stays full or empty,
+// shared by every copy of a channel value and deleted once the last copy is deleted
+typedef struct lispchannel
+{
+    _Atomic(int64_t) refs;
+
+    size_t mask;
+    lispchannelslot* slots;
+
+    // kept on separate cache lines so producers and consumers do not contend
+    _Alignas(64) atomic_size_t enqueue;
+    _Alignas(64) atomic_size_t dequeue;
+
+    _Alignas(64) atomic_int closed;
+
+    // threads sleeping on the channel, woken whenever a value is sent or received or it is closed
+    atomic_int waiting;
+    mtx_t lock;
+    cnd_t changed;
+} lispchannel;
+
+// functions to construct and destruct channels, the capacity is rounded up to a power of two
+lispchannel* lispchannel_new(int64_t capacity);
+void lispchannel_delete(lispchannel* c);
+
+// send a value the channel takes ownership of, waiting while it is full,
+// returns 0 without taking the value if the channel is closed
+int lispchannel_send(lispchannel* c, lispvalue* lv);
+
+// receive the next value, waiting while the channel is empty,
+// returns NULL once the channel is closed and every value sent before has been received
+lispvalue* lispchannel_receive(lispchannel* c);
+
+// stop the channel accepting values and wake everything waiting on it
+void lispchannel_close(lispchannel* c);
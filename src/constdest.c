@@ -6,6 +6,11 @@
 
 #include "builtins.h"
 #include "evaluator.h"
+#include "channel.h"
+#include "isolate.h"
+#include "future.h"
+#include "generator.h"
+#include "promise.h"
 
 #include "constdest.h"
 
@@ -45,14 +50,22 @@ lispvalue* lispvalue_number(int64_t x)
 }
 
 lispvalue* lispvalue_symbol(char* s)
+{
+    return lispvalue_symbol_length(s, strlen(s));
+}
+
+lispvalue* lispvalue_symbol_length(char* s, size_t length)
 {
     lispvalue* lv = malloc(sizeof(lispvalue));
     lv->type = LISPVALUE_SYMBOL;
 
-    // allocate one extra byte for the null-terminator
-    lv->symbol = malloc(strlen(s) + 1);
-    // the null-terminator is copied from src to dest
-    strcpy(lv->symbol, s);
+    // allocate one extra byte for the null-terminator, "s" need not have one
+    lv->symbol = malloc(length + 1);
+    memcpy(lv->symbol, s, length);
+    lv->symbol[length] = '\0';
+
+    lv->cache = lispcache_new();
+    lv->special = lv_name_to_special(lv->symbol);
 
     lv->cell_count = -1;
     lv->cells = NULL;
@@ -88,11 +101,28 @@ lispvalue* lispvalue_function(lispbuiltin function)
     lv->type = LISPVALUE_FUNCTION;
 
     lv->builtin = function;
+    lv->primitive = NULL;
 
     lv->env = NULL;
-    lv->formals = NULL;
-    lv->body = NULL;
-    
+    lv->code = NULL;
+
+    lv->cell_count = -1;
+    lv->cells = NULL;
+
+    return lv;
+}
+
+lispvalue* lispvalue_primitive(lispprimitive function)
+{
+    lispvalue* lv = malloc(sizeof(lispvalue));
+    lv->type = LISPVALUE_FUNCTION;
+
+    lv->builtin = NULL;
+    lv->primitive = function;
+
+    lv->env = NULL;
+    lv->code = NULL;
+
     lv->cell_count = -1;
     lv->cells = NULL;
 
@@ -104,12 +134,77 @@ lispvalue* lispvalue_lambda(lispvalue* formals, lispvalue* body)
     lispvalue* lv = malloc(sizeof(lispvalue));
     lv->type = LISPVALUE_FUNCTION;
 
-    // setting builtin to NULL means this is a user-defined function
+    // setting builtin and primitive to NULL means this is a user-defined function
     lv->builtin = NULL;
+    lv->primitive = NULL;
 
     lv->env = lispenv_new();
-    lv->formals = formals;
-    lv->body = body;
+    lv->code = lispcode_new(formals, body);
+
+    lv->cell_count = -1;
+    lv->cells = NULL;
+
+    return lv;
+}
+
+lispvalue* lispvalue_channel(lispchannel* c)
+{
+    lispvalue* lv = malloc(sizeof(lispvalue));
+    lv->type = LISPVALUE_CHANNEL;
+
+    lv->channel = c;
+
+    lv->cell_count = -1;
+    lv->cells = NULL;
+
+    return lv;
+}
+
+lispvalue* lispvalue_isolate(lispisolate* i)
+{
+    lispvalue* lv = malloc(sizeof(lispvalue));
+    lv->type = LISPVALUE_ISOLATE;
+
+    lv->isolate = i;
+
+    lv->cell_count = -1;
+    lv->cells = NULL;
+
+    return lv;
+}
+
+lispvalue* lispvalue_future(lispfuture* f)
+{
+    lispvalue* lv = malloc(sizeof(lispvalue));
+    lv->type = LISPVALUE_FUTURE;
+
+    lv->future = f;
+
+    lv->cell_count = -1;
+    lv->cells = NULL;
+
+    return lv;
+}
+
+lispvalue* lispvalue_generator(lispgenerator* g)
+{
+    lispvalue* lv = malloc(sizeof(lispvalue));
+    lv->type = LISPVALUE_GENERATOR;
+
+    lv->generator = g;
+
+    lv->cell_count = -1;
+    lv->cells = NULL;
+
+    return lv;
+}
+
+lispvalue* lispvalue_promise(lisppromise* p)
+{
+    lispvalue* lv = malloc(sizeof(lispvalue));
+    lv->type = LISPVALUE_PROMISE;
+
+    lv->promise = p;
 
     lv->cell_count = -1;
     lv->cells = NULL;
@@ -131,18 +226,25 @@ lispvalue* lispvalue_copy(lispvalue* lv)
     lispvalue* x = malloc(sizeof(lispvalue));
     x->type = lv->type;
 
+    x->cell_count = -1;
+    x->cells = NULL;
+
     switch (lv->type)
     {
         case LISPVALUE_NUMBER: x->number = lv->number; break;
         case LISPVALUE_FUNCTION:    
-            if (lv->builtin) x->builtin = lv->builtin;
-            
-            else
+            x->builtin = lv->builtin;
+            x->primitive = lv->primitive;
+            x->env = NULL;
+            x->code = NULL;
+
+            if (lv->code)
             {
-                x->builtin = NULL;
                 x->env = lispenv_copy(lv->env);
-                x->formals = lispvalue_copy(lv->formals);
-                x->body = lispvalue_copy(lv->body);
+
+                // the code is immutable, so the copy shares it
+                x->code = lv->code;
+                atomic_fetch_add_explicit(&x->code->refs, 1, memory_order_relaxed);
             }
 
             break;
@@ -155,6 +257,11 @@ lispvalue* lispvalue_copy(lispvalue* lv)
         case LISPVALUE_SYMBOL:
             x->symbol = malloc(strlen(lv->symbol) + 1);
             strcpy(x->symbol, lv->symbol);
+
+            // copies of a symbol are the same call site, so they share its cache
+            x->cache = lv->cache;
+            atomic_fetch_add_explicit(&x->cache->refs, 1, memory_order_relaxed);
+            x->special = lv->special;
             break;
 
         case LISPVALUE_SEXPRESSION:
@@ -164,11 +271,114 @@ lispvalue* lispvalue_copy(lispvalue* lv)
 
             for (int i = 0; i < x->cell_count; i++) x->cells[i] = lispvalue_copy(lv->cells[i]);
             break;
+
+        case LISPVALUE_CHANNEL:
+            x->channel = lv->channel;
+            atomic_fetch_add_explicit(&x->channel->refs, 1, memory_order_relaxed);
+            break;
+
+        case LISPVALUE_ISOLATE:
+            x->isolate = lv->isolate;
+            atomic_fetch_add_explicit(&x->isolate->refs, 1, memory_order_relaxed);
+            break;
+
+        case LISPVALUE_FUTURE:
+            x->future = lv->future;
+            atomic_fetch_add_explicit(&x->future->refs, 1, memory_order_relaxed);
+            break;
+
+        case LISPVALUE_GENERATOR:
+            x->generator = lv->generator;
+            atomic_fetch_add_explicit(&x->generator->refs, 1, memory_order_relaxed);
+            break;
+
+        case LISPVALUE_PROMISE:
+            x->promise = lv->promise;
+            atomic_fetch_add_explicit(&x->promise->refs, 1, memory_order_relaxed);
+            break;
     }
 
     return x;
 }
 
+lispvalue* lispvalue_transfer(lispvalue* lv)
+{
+    switch (lv->type)
+    {
+        // symbols get caches of their own, another isolate resolves them against another environment
+        case LISPVALUE_SYMBOL: return lispvalue_symbol(lv->symbol);
+
+        case LISPVALUE_FUNCTION:
+        {
+            if (!lv->code) return lispvalue_copy(lv);
+
+            lispvalue* x = lispvalue_lambda(lispvalue_transfer(lv->code->formals), lispvalue_transfer(lv->code->body));
+            lispenv_delete(x->env);
+            x->env = lispenv_transfer(lv->env);
+            return x;
+        }
+
+        // promises capture the environment they were made in, which stays behind
+        case LISPVALUE_PROMISE: return lispvalue_promise(lisppromise_transfer(lv->promise));
+
+        case LISPVALUE_SEXPRESSION:
+        case LISPVALUE_QEXPRESSION:
+        {
+            lispvalue* x = lv->type == LISPVALUE_SEXPRESSION ? lispvalue_sexpression() : lispvalue_qexpression();
+            x->cell_count = lv->cell_count;
+            x->cells = malloc(sizeof(lispvalue*) * x->cell_count);
+
+            for (int i = 0; i < x->cell_count; i++) x->cells[i] = lispvalue_transfer(lv->cells[i]);
+            return x;
+        }
+
+        // a future runs and is awaited through the virtual machine that started it, and a generator runs
+        // in the environment it was made in whichever thread resumes it, so both stay behind
+        case LISPVALUE_FUTURE:
+        case LISPVALUE_GENERATOR: return lispvalue_error("a %s cannot be used by another thread",
+        lv_type_to_name(lv->type));
+
+        // numbers and errors share nothing, channels and isolates are meant to be shared
+        default: return lispvalue_copy(lv);
+    }
+}
+
+lispvalue* lispvalue_untransferable(lispvalue* lv)
+{
+    switch (lv->type)
+    {
+        case LISPVALUE_FUTURE:
+        case LISPVALUE_GENERATOR: return lv;
+
+        case LISPVALUE_FUNCTION:
+        {
+            if (!lv->code) return NULL;
+
+            for (int i = 0; i < lv->env->symbol_count; i++)
+            {
+                lispvalue* x = lispvalue_untransferable(lv->env->values[i]);
+                if (x) return x;
+            }
+
+            return NULL;
+        }
+
+        case LISPVALUE_SEXPRESSION:
+        case LISPVALUE_QEXPRESSION:
+        {
+            for (int i = 0; i < lv->cell_count; i++)
+            {
+                lispvalue* x = lispvalue_untransferable(lv->cells[i]);
+                if (x) return x;
+            }
+
+            return NULL;
+        }
+
+        default: return NULL;
+    }
+}
+
 void lispvalue_delete(lispvalue* lv)
 {
     switch (lv->type)
@@ -178,17 +388,16 @@ void lispvalue_delete(lispvalue* lv)
 
         // delete function environment, formal arguments, and function body for user-defined functions
         case LISPVALUE_FUNCTION:
-            if (!lv->builtin)
+            if (lv->code)
             {
                 lispenv_delete(lv->env);
-                lispvalue_delete(lv->formals);
-                lispvalue_delete(lv->body);
+                lispcode_delete(lv->code);
             }
             break;
 
         // free string data for error and symbol type
         case LISPVALUE_ERROR: free(lv->error); break;
-        case LISPVALUE_SYMBOL: free(lv->symbol); break;
+        case LISPVALUE_SYMBOL: free(lv->symbol); lispcache_delete(lv->cache); break;
 
         // recursively free all elements inside s_expression and q_expression type
         // also free the s_expression and q_expression type itself
@@ -197,6 +406,12 @@ void lispvalue_delete(lispvalue* lv)
             for (int i = 0; i < lv->cell_count; i++) lispvalue_delete(lv->cells[i]);
             free(lv->cells);
             break;
+
+        case LISPVALUE_CHANNEL: lispchannel_delete(lv->channel); break;
+        case LISPVALUE_ISOLATE: lispisolate_delete(lv->isolate); break;
+        case LISPVALUE_FUTURE: lispfuture_delete(lv->future); break;
+        case LISPVALUE_GENERATOR: lispgenerator_delete(lv->generator); break;
+        case LISPVALUE_PROMISE: lisppromise_delete(lv->promise); break;
     }
 
     free(lv);
@@ -227,10 +442,51 @@ lispvalue* lispvalue_take(lispvalue* lv, int i)
     return x;
 }
 
+lispcode* lispcode_new(lispvalue* formals, lispvalue* body)
+{
+    lispcode* lc = malloc(sizeof(lispcode));
+    atomic_init(&lc->refs, 1);
+    lc->formals = formals;
+    lc->body = body;
+
+    return lc;
+}
+
+void lispcode_delete(lispcode* lc)
+{
+    if (atomic_fetch_sub_explicit(&lc->refs, 1, memory_order_acq_rel) != 1) return;
+
+    lispvalue_delete(lc->formals);
+    lispvalue_delete(lc->body);
+    free(lc);
+}
+
+lispcache* lispcache_new()
+{
+    lispcache* c = malloc(sizeof(lispcache));
+    atomic_init(&c->refs, 1);
+    atomic_init(&c->version, 0);
+    atomic_init(&c->slot, -1);
+
+    return c;
+}
+
+void lispcache_delete(lispcache* c)
+{
+    if (atomic_fetch_sub_explicit(&c->refs, 1, memory_order_acq_rel) != 1) return;
+    free(c);
+}
+
+// every environment version is unique across the process, so a cache can never
+// match an environment that was freed and reallocated at the same address
+static atomic_uint_fast64_t lispenv_versions = 0;
+
 lispenv* lispenv_new()
 {
     lispenv* le = malloc(sizeof(lispenv));
     le->parent = NULL;
+    le->version = 0;
+    atomic_init(&le->shared, 0);
     le->symbol_count = 0;
     le->symbols = NULL;
     le->values = NULL;
@@ -242,6 +498,8 @@ lispenv* lispenv_copy(lispenv* le)
 {
     lispenv* n = malloc(sizeof(lispenv));
     n->parent = le->parent;
+    n->version = 0;
+    atomic_init(&n->shared, 0);
     n->symbol_count = le->symbol_count;
     n->symbols = malloc(sizeof(char*) * le->symbol_count);
     n->values = malloc(sizeof(lispvalue*) * le->symbol_count);
@@ -256,6 +514,51 @@ lispenv* lispenv_copy(lispenv* le)
     return n;
 }
 
+lispenv* lispenv_transfer(lispenv* le)
+{
+    lispenv* n = lispenv_new();
+
+    // the copy is the root of its own environment, so give it a version for inline caches to match
+    n->version = atomic_fetch_add(&lispenv_versions, 1) + 1;
+    n->symbol_count = le->symbol_count;
+    n->symbols = malloc(sizeof(char*) * le->symbol_count);
+    n->values = malloc(sizeof(lispvalue*) * le->symbol_count);
+
+    for (int i = 0; i < le->symbol_count; i++)
+    {
+        n->symbols[i] = malloc(strlen(le->symbols[i]) + 1);
+        strcpy(n->symbols[i], le->symbols[i]);
+        n->values[i] = lispvalue_transfer(le->values[i]);
+    }
+
+    return n;
+}
+
+lispenv* lispenv_capture(lispenv* le)
+{
+    lispenv* root = le;
+    while (root->parent) root = root->parent;
+
+    lispenv* captured = lispenv_new();
+    captured->parent = root;
+
+    // inner frames come first and shadow the outer ones
+    for (; le->parent; le = le->parent)
+    {
+        for (int i = 0; i < le->symbol_count; i++)
+        {
+            int shadowed = 0;
+
+            for (int j = 0; j < captured->symbol_count && !shadowed; j++)
+            shadowed = !strcmp(captured->symbols[j], le->symbols[i]);
+
+            if (!shadowed) lispenv_put(captured, le->symbols[i], le->values[i]);
+        }
+    }
+
+    return captured;
+}
+
 void lispenv_delete(lispenv* le)
 {
     for (int i = 0; i < le->symbol_count; i++)
@@ -270,6 +573,11 @@ void lispenv_delete(lispenv* le)
 }
 
 void lispenv_put(lispenv* le, char* symbol, lispvalue* lv)
+{
+    lispenv_bind(le, symbol, lispvalue_copy(lv));
+}
+
+void lispenv_bind(lispenv* le, char* symbol, lispvalue* lv)
 {
     // iterate over stored symbols, check for existence
     // if one already exists (given symbol has been defined), replace value 
@@ -278,18 +586,21 @@ void lispenv_put(lispenv* le, char* symbol, lispvalue* lv)
         if (!strcmp(le->symbols[i], symbol))
         {
             lispvalue_delete(le->values[i]);
-            le->values[i] = lispvalue_copy(lv);
+            le->values[i] = lv;
             return;
         }
     }
     
-    // otherwise allocate memory for new symbol
+    // otherwise allocate memory for new symbol,
+    // rebinding above reuses the slot so only this invalidates inline caches,
+    // which only ever resolve against global environments
+    if (!le->parent) le->version = atomic_fetch_add(&lispenv_versions, 1) + 1;
     le->symbol_count++;
     le->symbols = realloc(le->symbols, sizeof(char*) * le->symbol_count);
     le->values = realloc(le->values, sizeof(lispvalue*) * le->symbol_count);
 
-    // copy given symbol and value into environment's memory
-    le->values[le->symbol_count - 1] = lispvalue_copy(lv);
+    // store given value and a copy of the symbol into environment's memory
+    le->values[le->symbol_count - 1] = lv;
     le->symbols[le->symbol_count - 1] = malloc(strlen(symbol) + 1);
     strcpy(le->symbols[le->symbol_count - 1], symbol);
 }
@@ -304,6 +615,43 @@ lispvalue* lispenv_get(lispenv* le, char* symbol)
     else return lispvalue_error("unbound symbol \"%s\"", symbol);
 }
 
+lispvalue* lispenv_lookup(lispenv* le, lispvalue* symbol)
+{
+    // local environments are small (formal arguments), so scan them directly
+    for (; le->parent; le = le->parent)
+    {
+        for (int i = 0; i < le->symbol_count; i++)
+        if (!strcmp(le->symbols[i], symbol->symbol)) return le->values[i];
+    }
+
+    // the global environment is where the cache pays off, the slot is published
+    // before the version so threads sharing the symbol never see a version without its slot
+    lispcache* c = symbol->cache;
+
+    if (le->version && atomic_load_explicit(&c->version, memory_order_acquire) == le->version)
+    {
+        int64_t slot = atomic_load_explicit(&c->slot, memory_order_relaxed);
+        return slot < 0 ? NULL : le->values[slot];
+    }
+
+    int64_t slot = -1;
+
+    for (int i = 0; i < le->symbol_count; i++)
+    {
+        if (!strcmp(le->symbols[i], symbol->symbol))
+        {
+            slot = i;
+            break;
+        }
+    }
+
+    // a miss is cached too, adding the symbol later changes the version
+    atomic_store_explicit(&c->slot, slot, memory_order_relaxed);
+    atomic_store_explicit(&c->version, le->version, memory_order_release);
+
+    return slot < 0 ? NULL : le->values[slot];
+}
+
 void lispenv_define(lispenv* le, char* symbol, lispvalue* lv)
 {
     while (le->parent) le = le->parent;
@@ -311,6 +659,11 @@ void lispenv_define(lispenv* le, char* symbol, lispvalue* lv)
     return lispenv_put(le, symbol, lv);
 }
 
+void lispenv_add_primitive(lispenv* le, char* name, lispprimitive function)
+{
+    lispenv_bind(le, name, lispvalue_primitive(function));
+}
+
 void lispenv_add_builtin(lispenv* le, char* name, lispbuiltin function)
 {
     lispvalue* value = lispvalue_function(function);
@@ -321,20 +674,64 @@ void lispenv_add_builtin(lispenv* le, char* name, lispbuiltin function)
 void lispenv_add_builtins(lispenv* le)
 {
     // list functions
-    lispenv_add_builtin(le, DEFINE_STR, builtin_define);
-    lispenv_add_builtin(le, LEN_STR, builtin_len);
-    lispenv_add_builtin(le, LIST_STR, builtin_list);
-    lispenv_add_builtin(le, HEAD_STR, builtin_head);
-    lispenv_add_builtin(le, TAIL_STR, builtin_tail);
-    lispenv_add_builtin(le, JOIN_STR, builtin_join);
-    lispenv_add_builtin(le, REVERSE_STR, builtin_reverse);
-    lispenv_add_builtin(le, EVAL_STR, builtin_eval);
-    lispenv_add_builtin(le, LAMBDA_STR, builtin_lambda);
+    lispenv_add_primitive(le, DEFINE_STR, builtin_define);
+    lispenv_add_primitive(le, LEN_STR, builtin_len);
+    lispenv_add_primitive(le, LIST_STR, builtin_list);
+    lispenv_add_primitive(le, HEAD_STR, builtin_head);
+    lispenv_add_primitive(le, TAIL_STR, builtin_tail);
+    lispenv_add_primitive(le, JOIN_STR, builtin_join);
+    lispenv_add_primitive(le, REVERSE_STR, builtin_reverse);
+    lispenv_add_primitive(le, EVAL_STR, builtin_eval);
+    lispenv_add_primitive(le, LAMBDA_STR, builtin_lambda);
+
+    // higher-order list functions
+    lispenv_add_primitive(le, MAP_STR, builtin_map);
+    lispenv_add_primitive(le, FILTER_STR, builtin_filter);
+    lispenv_add_primitive(le, FOLD_STR, builtin_fold);
+    lispenv_add_primitive(le, FOR_EACH_STR, builtin_for_each);
+
+    // parallel list functions
+    lispenv_add_primitive(le, PMAP_STR, builtin_pmap);
+    lispenv_add_primitive(le, PFILTER_STR, builtin_pfilter);
+    lispenv_add_primitive(le, PREDUCE_STR, builtin_preduce);
+    lispenv_add_primitive(le, WORKERS_STR, builtin_workers);
+
+    // isolate and channel functions
+    lispenv_add_primitive(le, SPAWN_STR, builtin_spawn);
+    lispenv_add_primitive(le, WAIT_STR, builtin_wait);
+    lispenv_add_primitive(le, CHANNEL_STR, builtin_channel);
+    lispenv_add_primitive(le, SEND_STR, builtin_send);
+    lispenv_add_primitive(le, RECEIVE_STR, builtin_receive);
+    lispenv_add_primitive(le, CLOSE_STR, builtin_close);
+
+    // asynchronous functions
+    lispenv_add_primitive(le, FUTURE_STR, builtin_future);
+    lispenv_add_primitive(le, AWAIT_STR, builtin_await);
+
+    // generator functions
+    lispenv_add_primitive(le, GENERATOR_STR, builtin_generator);
+    lispenv_add_primitive(le, YIELD_STR, builtin_yield);
+    lispenv_add_primitive(le, NEXT_STR, builtin_next);
+    lispenv_add_primitive(le, DONE_STR, builtin_done);
+
+    // lazy sequence functions
+    lispenv_add_primitive(le, FORCE_STR, builtin_force);
+    lispenv_add_primitive(le, LAZY_RANGE_STR, builtin_lazy_range);
+    lispenv_add_primitive(le, LAZY_MAP_STR, builtin_lazy_map);
+    lispenv_add_primitive(le, TAKE_STR, builtin_take);
 
     // mathematical functions
-    lispenv_add_builtin(le, ADD_SYMBOL_STR, builtin_add);
-    lispenv_add_builtin(le, SUB_SYMBOL_STR, builtin_sub);
-    lispenv_add_builtin(le, MUL_SYMBOL_STR, builtin_mul);
-    lispenv_add_builtin(le, DIV_SYMBOL_STR, builtin_div);
-    lispenv_add_builtin(le, REM_SYMBOL_STR, builtin_rem);
+    lispenv_add_primitive(le, ADD_SYMBOL_STR, builtin_add);
+    lispenv_add_primitive(le, SUB_SYMBOL_STR, builtin_sub);
+    lispenv_add_primitive(le, MUL_SYMBOL_STR, builtin_mul);
+    lispenv_add_primitive(le, DIV_SYMBOL_STR, builtin_div);
+    lispenv_add_primitive(le, REM_SYMBOL_STR, builtin_rem);
+
+    // comparison functions
+    lispenv_add_primitive(le, EQ_SYMBOL_STR, builtin_eq);
+    lispenv_add_primitive(le, NE_SYMBOL_STR, builtin_ne);
+    lispenv_add_primitive(le, LT_SYMBOL_STR, builtin_lt);
+    lispenv_add_primitive(le, GT_SYMBOL_STR, builtin_gt);
+    lispenv_add_primitive(le, LE_SYMBOL_STR, builtin_le);
+    lispenv_add_primitive(le, GE_SYMBOL_STR, builtin_ge);
 }
\ No newline at end of file
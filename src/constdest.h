@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "definitions.h"
 
 #ifndef MAX_STR_LENGTH
@@ -14,11 +16,20 @@
 lispvalue* lispvalue_error(char* format, ...);
 lispvalue* lispvalue_number(int64_t x);
 lispvalue* lispvalue_symbol(char* s);
+lispvalue* lispvalue_symbol_length(char* s, size_t length);
 lispvalue* lispvalue_sexpression();
 lispvalue* lispvalue_qexpression();
 lispvalue* lispvalue_function(lispbuiltin function);
+lispvalue* lispvalue_primitive(lispprimitive function);
 lispvalue* lispvalue_lambda(lispvalue* formals, lispvalue* body);
 
+// these take over the caller's reference to the channel or isolate
+lispvalue* lispvalue_channel(lispchannel* c);
+lispvalue* lispvalue_isolate(lispisolate* i);
+lispvalue* lispvalue_future(lispfuture* f);
+lispvalue* lispvalue_generator(lispgenerator* g);
+lispvalue* lispvalue_promise(lisppromise* p);
+
 // function to add child elements into a lispvalue's cells
 // (for s_expressions and q_expressions)
 lispvalue* lispvalue_add(lispvalue* lv, lispvalue* new_lv);
@@ -27,12 +38,28 @@ lispvalue* lispvalue_add(lispvalue* lv, lispvalue* new_lv);
 lispvalue* lispvalue_copy(lispvalue* lv);
 void lispvalue_delete(lispvalue* lv);
 
+// like "lispvalue_copy" but shares nothing with the original except channels and isolates, which are made
+// to be used from any thread, so the copy can be handed to another isolate or future and used on its thread,
+// promises are transferred by "lisppromise_transfer", and futures and generators, which belong to the
+// virtual machine and thread that made them, become errors
+lispvalue* lispvalue_transfer(lispvalue* lv);
+
+// the first value inside "lv" which "lispvalue_transfer" turns into an error, or NULL if there is none
+lispvalue* lispvalue_untransferable(lispvalue* lv);
+
 // function to "pop" a child element of a lispvalue given index "i"
 lispvalue* lispvalue_pop(lispvalue* lv, int i);
 
 // like "lispvalue_pop" but deletes the child element after popping
 lispvalue* lispvalue_take(lispvalue* lv, int i);
 
+// functions to construct and destruct the shared parts of lisp values,
+// these are reference counted and deleted once the last copy is deleted
+lispcode* lispcode_new(lispvalue* formals, lispvalue* body);
+void lispcode_delete(lispcode* lc);
+lispcache* lispcache_new();
+void lispcache_delete(lispcache* c);
+
 // /////////////////////////////////////////////////
 // // FUNCTION DECLERATIONS FOR LISP ENVIRONMENTS //
 // /////////////////////////////////////////////////
@@ -40,13 +67,28 @@ lispvalue* lispvalue_take(lispvalue* lv, int i);
 // functions to construct and destruct lisp environments
 lispenv* lispenv_new();
 lispenv* lispenv_copy(lispenv* le);
+
+// copies every binding visible from "le" below the global environment into one environment on top of it,
+// for things that run later, when the frames they were made in may be gone
+lispenv* lispenv_capture(lispenv* le);
+
+// like "lispenv_copy" but transfers the values (see "lispvalue_transfer") into a new global environment
+lispenv* lispenv_transfer(lispenv* le);
 void lispenv_delete(lispenv* le);
 
 // functions to put and get a symbol to its corresponding values into an environment
 void lispenv_put(lispenv* le, char* symbol, lispvalue* lv);
+
+// like "lispenv_put" but takes ownership of the value instead of copying it
+void lispenv_bind(lispenv* le, char* symbol, lispvalue* lv);
 lispvalue* lispenv_get(lispenv* le, char* symbol);
+
+// like "lispenv_get" but goes through the symbol's inline cache and returns
+// the bound value itself rather than a copy, or NULL if the symbol is unbound
+lispvalue* lispenv_lookup(lispenv* le, lispvalue* symbol);
 void lispenv_define(lispenv* le, char* symbol, lispvalue* lv);
 
 // functions to add builtin functions into an environment
 void lispenv_add_builtin(lispenv* le, char* name, lispbuiltin function);
+void lispenv_add_primitive(lispenv* le, char* name, lispprimitive function);
 void lispenv_add_builtins(lispenv* le);
\ No newline at end of file
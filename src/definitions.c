@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "definitions.h"
 
 char* lv_type_to_name(int8_t type)
@@ -10,6 +12,26 @@ char* lv_type_to_name(int8_t type)
         case LISPVALUE_SEXPRESSION: return "s_expression";
         case LISPVALUE_QEXPRESSION: return "q_expression";
         case LISPVALUE_FUNCTION:    return "function";
+        case LISPVALUE_CHANNEL:     return "channel";
+        case LISPVALUE_ISOLATE:     return "isolate";
+        case LISPVALUE_FUTURE:      return "future";
+        case LISPVALUE_GENERATOR:   return "generator";
+        case LISPVALUE_PROMISE:     return "promise";
         default:                    return "unknown";
     }
+}
+
+int8_t lv_name_to_special(char* name)
+{
+    if (!strcmp(name, IF_STR))      return SPECIAL_IF;
+    if (!strcmp(name, LET_STR))     return SPECIAL_LET;
+    if (!strcmp(name, DO_STR))      return SPECIAL_DO;
+    if (!strcmp(name, AND_STR))     return SPECIAL_AND;
+    if (!strcmp(name, OR_STR))      return SPECIAL_OR;
+    if (!strcmp(name, COND_STR))    return SPECIAL_COND;
+    if (!strcmp(name, WHILE_STR))   return SPECIAL_WHILE;
+    if (!strcmp(name, DOTIMES_STR)) return SPECIAL_DOTIMES;
+    if (!strcmp(name, FOR_RANGE_STR)) return SPECIAL_FOR_RANGE;
+    if (!strcmp(name, DELAY_STR))   return SPECIAL_DELAY;
+    return SPECIAL_NONE;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdatomic.h>
 
 // #include "evaluator.h"
 
@@ -25,15 +26,80 @@
 #define EVAL_STR            "eval"
 #define LAMBDA_STR          "\\"
 
+#define MAP_STR             "map"
+#define FILTER_STR          "filter"
+#define FOLD_STR            "fold"
+#define FOR_EACH_STR        "for-each"
+
+#define PMAP_STR            "pmap"
+#define PFILTER_STR         "pfilter"
+#define PREDUCE_STR         "preduce"
+#define WORKERS_STR         "workers"
+
+#define SPAWN_STR           "spawn"
+#define WAIT_STR            "wait"
+#define CHANNEL_STR         "channel"
+#define SEND_STR            "send"
+#define RECEIVE_STR         "recv"
+#define CLOSE_STR           "close"
+
+#define FUTURE_STR          "future"
+#define AWAIT_STR           "await"
+
+#define GENERATOR_STR       "generator"
+#define YIELD_STR           "yield"
+#define NEXT_STR            "next"
+#define DONE_STR            "done"
+
+#define FORCE_STR           "force"
+#define LAZY_RANGE_STR      "lazy-range"
+#define LAZY_MAP_STR        "lazy-map"
+#define TAKE_STR            "take"
+
+// special forms are recognised by the evaluator and decide themselves which arguments to evaluate
+#define IF_STR              "if"
+#define LET_STR             "let"
+#define DO_STR              "do"
+#define AND_STR             "and"
+#define OR_STR              "or"
+#define COND_STR            "cond"
+#define WHILE_STR           "while"
+#define DOTIMES_STR         "dotimes"
+#define FOR_RANGE_STR       "for-range"
+#define DELAY_STR           "delay"
+
 #define ADD_SYMBOL_STR "+"
 #define SUB_SYMBOL_STR "-"
 #define MUL_SYMBOL_STR "*"
 #define DIV_SYMBOL_STR "/"
 #define REM_SYMBOL_STR "%"
 
+#define EQ_SYMBOL_STR  "=="
+#define NE_SYMBOL_STR  "!="
+#define LT_SYMBOL_STR  "<"
+#define GT_SYMBOL_STR  ">"
+#define LE_SYMBOL_STR  "<="
+#define GE_SYMBOL_STR  ">="
+
 enum OPERATION_SYMBOL
 {
-    ADD = 10, SUB, MUL, DIV, REM
+    ADD = 10, SUB, MUL, DIV, REM,
+    EQ, NE, LT, GT, LE, GE
+};
+
+enum SPECIAL_FORM
+{
+    SPECIAL_NONE = 0,
+    SPECIAL_IF,
+    SPECIAL_LET,
+    SPECIAL_DO,
+    SPECIAL_AND,
+    SPECIAL_OR,
+    SPECIAL_COND,
+    SPECIAL_WHILE,
+    SPECIAL_DOTIMES,
+    SPECIAL_FOR_RANGE,
+    SPECIAL_DELAY
 };
 
 enum LISPVALUE_TYPE
@@ -43,26 +109,81 @@ enum LISPVALUE_TYPE
     LISPVALUE_SYMBOL,
     LISPVALUE_SEXPRESSION,
     LISPVALUE_QEXPRESSION,
-    LISPVALUE_FUNCTION
+    LISPVALUE_FUNCTION,
+    LISPVALUE_CHANNEL,
+    LISPVALUE_ISOLATE,
+    LISPVALUE_FUTURE,
+    LISPVALUE_GENERATOR,
+    LISPVALUE_PROMISE
 };
 
+struct lispvm;
 struct lispenv;
 struct lispvalue;
+struct lispcode;
+struct lispcache;
+struct lispchannel;
+struct lispisolate;
+struct lispfuture;
+struct lispgenerator;
+struct lisppromise;
+typedef struct lispvm lispvm;
 typedef struct lispenv lispenv;
 typedef struct lispvalue lispvalue;
-
-// function pointer to point to builtin functions
+typedef struct lispcode lispcode;
+typedef struct lispcache lispcache;
+typedef struct lispchannel lispchannel;
+typedef struct lispisolate lispisolate;
+typedef struct lispfuture lispfuture;
+typedef struct lispgenerator lispgenerator;
+typedef struct lisppromise lisppromise;
+
+// function pointer to point to builtin functions taking their arguments packed into an s_expression,
+// the builtin owns that s_expression (kept for compatibility, calls go through an adapter)
 typedef lispvalue*(*lispbuiltin)(lispenv*, lispvalue*);
 
+// function pointer to point to primitive functions, the calling convention builtins use,
+// arguments are borrowed from a stack owned by the caller which deletes them after the call,
+// a primitive may take ownership of an argument instead by setting its slot to NULL
+typedef lispvalue*(*lispprimitive)(lispvm*, lispenv*, int, lispvalue**);
+
 // lisp environment struct to store declared variables and builtin and declared functions
 typedef struct lispenv
 {
     lispenv* parent;
+
+    // changes whenever a symbol is added to a global environment, so inline caches
+    // resolved against it can tell whether they are still valid, zero until then
+    uint64_t version;
+
+    // number of parallel builtins currently reading this environment from other threads,
+    // it cannot be defined into while this is non-zero
+    atomic_int shared;
+
     int64_t symbol_count;
     char** symbols;
     lispvalue** values;
 } lispenv;
 
+// formal arguments and body of a user-defined function,
+// shared between all copies of that function instead of being deep-copied
+typedef struct lispcode
+{
+    _Atomic(int64_t) refs;
+    lispvalue* formals;
+    lispvalue* body;
+} lispcode;
+
+// monomorphic inline cache for a symbol, shared between all copies of that symbol,
+// remembering which slot of the global environment it was last resolved to, or -1 if it was unbound there,
+// environment versions are unique so the version alone identifies the environment
+typedef struct lispcache
+{
+    _Atomic(int64_t) refs;
+    _Atomic(uint64_t) version;
+    _Atomic(int64_t) slot;
+} lispcache;
+
 // lisp value struct to store a value's type and the value itself,
 // as well as its child elements (for s_expressions and q_expressions)
 typedef struct lispvalue
@@ -73,15 +194,31 @@ typedef struct lispvalue
     {
         int64_t number;
         char* error;
-        char* symbol;
 
+        struct
+        {
+            char* symbol;
+            lispcache* cache;
+
+            // which special form the symbol names while nothing binds it, worked out once when the symbol is made
+            int8_t special;
+        };
+
+        // user-defined functions have code, builtin functions have a builtin or primitive
         struct
         {
             lispbuiltin builtin;
+            lispprimitive primitive;
             lispenv* env;
-            lispvalue* formals;
-            lispvalue* body;
+            lispcode* code;
         };
+
+        // shared with every copy of the value, including ones transferred to other isolates
+        lispchannel* channel;
+        lispisolate* isolate;
+        lispfuture* future;
+        lispgenerator* generator;
+        lisppromise* promise;
     };
 
     int64_t cell_count;
@@ -89,4 +226,5 @@ typedef struct lispvalue
 } lispvalue;
 
 char* lv_type_to_name(int8_t type);
+int8_t lv_name_to_special(char* name);
 // char* lv_function_to_name(lispbuiltin function);
\ No newline at end of file
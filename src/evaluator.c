@@ -3,100 +3,479 @@
 
 #include "constdest.h"
 #include "builtins.h"
+#include "vm.h"
+#include "promise.h"
+#include "generator.h"
 
 #include "evaluator.h"
 
-lispvalue* lispvalue_call(lispenv* le, lispvalue* function, lispvalue* lv)
+// calls with up to this many arguments keep them on the C stack
+#define MAX_INLINE_ARGS 8
+
+lispvalue* lispvalue_call(lispvm* vm, lispenv* le, lispvalue* function, lispvalue* lv)
 {
     if (function->builtin) return function->builtin(le, lv);
 
-    int given = lv->cell_count;
-    int total = function->formals->cell_count;
+    // the arguments are moved onto the stack, so only the s_expression itself is freed
+    lispvalue* result = lispvalue_apply(vm, le, function, lv->cell_count, lv->cells);
+
+    for (int i = 0; i < lv->cell_count; i++) if (lv->cells[i]) lispvalue_delete(lv->cells[i]);
+    free(lv->cells);
+    free(lv);
+
+    return result;
+}
 
-    // while arguments remain to be processed
-    while (lv->cell_count)
+lispvalue* lispvalue_apply(lispvm* vm, lispenv* le, lispvalue* function, int argc, lispvalue** argv)
+{
+    if (function->primitive) return function->primitive(vm, le, argc, argv);
+
+    // adapter for builtins taking their arguments packed into an s_expression
+    if (function->builtin)
     {
-        // if we ran out of formal arguments to bind, throw an error
-        if (function->formals->cell_count == 0)
+        lispvalue* lv = lispvalue_sexpression();
+        lv->cell_count = argc;
+        lv->cells = malloc(sizeof(lispvalue*) * argc);
+
+        for (int i = 0; i < argc; i++)
         {
-            lispvalue_delete(lv);
-            return lispvalue_error("function passed in too many arguments: "
-            "expected %i, got %i", total, given);
+            lv->cells[i] = argv[i];
+            argv[i] = NULL;
         }
 
-        // pop the first symbol from the formals
-        lispvalue* symbol = lispvalue_pop(function->formals, 0);
+        return function->builtin(le, lv);
+    }
 
-        // pop next argument from the list
-        lispvalue* value = lispvalue_pop(lv, 0);
+    lispvalue* formals = function->code->formals;
 
-        // bind a copy into the function's environment
-        lispenv_put(function->env, symbol->symbol, value);
+    int total = formals->cell_count;
 
-        lispvalue_delete(symbol); lispvalue_delete(value);
+    // if we have more arguments than formal arguments to bind, throw an error
+    if (argc > total)
+    {
+        return lispvalue_error("function passed in too many arguments: "
+        "expected %i, got %i", total, argc);
     }
 
-    // argument list has now been cleared up so delete
-    lispvalue_delete(lv);
+    // move the arguments into a fresh environment, the function itself is left
+    // untouched so it can be called straight out of the environment it is bound in
+    lispenv* env = lispenv_copy(function->env);
+    env->parent = le;
 
-    // if all formals have been bound, evaluate function
-    if (function->formals->cell_count == 0)
+    for (int i = 0; i < argc; i++)
     {
-        function->env->parent = le;
+        lispenv_bind(env, formals->cells[i]->symbol, argv[i]);
+        argv[i] = NULL;
+    }
+
+    // if not all formals have been bound, return partially evaluated function
+    if (argc < total)
+    {
+        lispvalue* remaining = lispvalue_qexpression();
+
+        for (int i = argc; i < total; i++)
+        remaining = lispvalue_add(remaining, lispvalue_copy(formals->cells[i]));
+
+        lispvalue* partial = lispvalue_lambda(remaining, lispvalue_copy(function->code->body));
+        lispenv_delete(partial->env);
+        partial->env = env;
 
-        return builtin_eval(function->env,
-        lispvalue_add(lispvalue_sexpression(),
-        lispvalue_copy(function->body)));
+        return partial;
     }
-    
-    // else return partially evaluated function
-    else return lispvalue_copy(function); 
+
+    // else evaluate the body in place, holding on to the code in case
+    // the body redefines the function it is running
+    lispcode* code = function->code;
+    atomic_fetch_add_explicit(&code->refs, 1, memory_order_relaxed);
+
+    lispvalue* result = lispvalue_eval_sexpression(vm, env, code->body);
+
+    lispcode_delete(code);
+    lispenv_delete(env);
+
+    return result;
 }
 
 
-lispvalue* lispvalue_eval(lispenv* le, lispvalue* lv)
+lispvalue* lispvalue_eval(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    // only symbols and s_expressions evaluate to something other than themselves
+    if (lv->type != LISPVALUE_SYMBOL && lv->type != LISPVALUE_SEXPRESSION) return lv;
+
+    lispvalue* x = lispvalue_eval_borrowed(vm, le, lv);
+    lispvalue_delete(lv);
+    return x;
+}
+
+lispvalue* lispvalue_eval_borrowed(lispvm* vm, lispenv* le, lispvalue* lv)
 {
     // evaluate symbols, do symbol lookup on the environment
     if (lv->type == LISPVALUE_SYMBOL)
     {
-        lispvalue* x = lispenv_get(le, lv->symbol);
-        lispvalue_delete(lv);
-        return x;
+        lispvalue* x = lispenv_lookup(le, lv);
+        return x ? lispvalue_copy(x) : lispvalue_error("unbound symbol \"%s\"", lv->symbol);
     }
 
     // evaluate s_expressions
     if (lv->type == LISPVALUE_SEXPRESSION)
-    return lispvalue_eval_sexpression(le, lv);
+    return lispvalue_eval_sexpression(vm, le, lv);
 
     // otherwise remain the same
-    return lv;
+    return lispvalue_copy(lv);
 }
 
-lispvalue* lispvalue_eval_sexpression(lispenv* le, lispvalue* lv)
+lispvalue* lispvalue_eval_sexpression(lispvm* vm, lispenv* le, lispvalue* lv)
 {
-    // evaluate children
-    for (int i = 0; i < lv->cell_count; i++)
-    lv->cells[i] = lispvalue_eval(le, lv->cells[i]);
-    
-    // error checking
-    for (int i = 0; i < lv->cell_count; i++)
-    if (lv->cells[i]->type == LISPVALUE_ERROR) return lispvalue_take(lv, i);
+    if (lv->cell_count == 0) return lispvalue_sexpression();
+
+    // generators run on stacks of their own, which are much smaller than the thread's
+    if (lispgenerator_stack_exhausted())
+    return lispvalue_error("generator recursed too deeply and ran out of stack");
+
+    // a special form's name only means the special form while nothing binds it, so
+    // definitions, lambda parameters and "let" bindings of the same name shadow it
+    if (lv->cells[0]->type == LISPVALUE_SYMBOL && lv->cells[0]->special && !lispenv_lookup(le, lv->cells[0]))
+    return lispvalue_eval_special(vm, le, lv);
+
+    if (lv->cell_count == 1) return lispvalue_eval_borrowed(vm, le, lv->cells[0]);
+
+    lispvalue* result = NULL;
+    lispvalue* function = NULL;
+    lispvalue* owned = NULL;
+
+    // the head is evaluated first and then the arguments left to right, a symbol at the head
+    // is a call site resolved through its inline cache without copying
+    if (lv->cells[0]->type == LISPVALUE_SYMBOL)
+    {
+        function = lispenv_lookup(le, lv->cells[0]);
+        if (!function) return lispvalue_error("unbound symbol \"%s\"", lv->cells[0]->symbol);
+    }
+
+    else
+    {
+        function = owned = lispvalue_eval_borrowed(vm, le, lv->cells[0]);
+        if (function->type == LISPVALUE_ERROR) return owned;
+    }
 
-    if (lv->cell_count == 0) return lv;
+    // evaluate the arguments onto a stack owned by this call
+    int argc = lv->cell_count - 1;
 
-    if (lv->cell_count == 1) return lispvalue_take(lv, 0);
+    lispvalue* inline_args[MAX_INLINE_ARGS];
+    lispvalue** argv = argc <= MAX_INLINE_ARGS ? inline_args : malloc(sizeof(lispvalue*) * argc);
+
+    // evaluating an s_expression argument can rebind the symbol at the head and free what it
+    // resolved to, so after one the head is looked up again and the call uses its new binding
+    int rebindable = 0;
+    int evaluated = 0;
+
+    for (; evaluated < argc; evaluated++)
+    {
+        rebindable |= lv->cells[evaluated + 1]->type == LISPVALUE_SEXPRESSION;
+        argv[evaluated] = lispvalue_eval_borrowed(vm, le, lv->cells[evaluated + 1]);
+
+        // error checking, stop at the first error
+        if (argv[evaluated]->type == LISPVALUE_ERROR)
+        {
+            result = argv[evaluated];
+            argv[evaluated] = NULL;
+            evaluated++;
+            goto cleanup;
+        }
+    }
+
+    if (rebindable && !owned)
+    {
+        function = lispenv_lookup(le, lv->cells[0]);
+
+        if (!function)
+        {
+            result = lispvalue_error("unbound symbol \"%s\"", lv->cells[0]->symbol);
+            goto cleanup;
+        }
+    }
 
-    lispvalue* function = lispvalue_pop(lv, 0);
-    
     // verify that the first element is a function
     if (function->type != LISPVALUE_FUNCTION)
     {
-        lispvalue_delete(function); lispvalue_delete(lv);
-        return lispvalue_error("first element is not a function");
+        result = lispvalue_error("first element is not a function");
+        goto cleanup;
+    }
+
+    result = lispvalue_apply(vm, le, function, argc, argv);
+
+cleanup:
+    // delete whatever arguments the call did not take ownership of
+    for (int i = 0; i < evaluated; i++) if (argv[i]) lispvalue_delete(argv[i]);
+    if (argv != inline_args) free(argv);
+    if (owned) lispvalue_delete(owned);
+
+    return result;
+}
+
+
+int lispvalue_truthy(lispvalue* lv)
+{
+    switch (lv->type)
+    {
+        case LISPVALUE_NUMBER: return lv->number != 0;
+        case LISPVALUE_SEXPRESSION:
+        case LISPVALUE_QEXPRESSION: return lv->cell_count != 0;
+        default: return 1;
+    }
+}
+
+// a branch of "if" or "cond" given as a q_expression is code, evaluate it as an s_expression
+static lispvalue* lispvalue_eval_branch(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    if (lv->type == LISPVALUE_QEXPRESSION) return lispvalue_eval_sexpression(vm, le, lv);
+    return lispvalue_eval_borrowed(vm, le, lv);
+}
+
+// evaluates cells from index "start" in order, returning the last result or the first error
+static lispvalue* lispvalue_eval_sequence(lispvm* vm, lispenv* le, lispvalue* lv, int start)
+{
+    if (start >= lv->cell_count) return lispvalue_sexpression();
+
+    for (int i = start; i < lv->cell_count - 1; i++)
+    {
+        lispvalue* x = lispvalue_eval_borrowed(vm, le, lv->cells[i]);
+        if (x->type == LISPVALUE_ERROR) return x;
+        lispvalue_delete(x);
+    }
+
+    return lispvalue_eval_borrowed(vm, le, lv->cells[lv->cell_count - 1]);
+}
+
+static lispvalue* lispvalue_eval_if(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    if (lv->cell_count != 3 && lv->cell_count != 4)
+    return lispvalue_error("special form \"if\" passed in an incorrect number of arguments: "
+    "expected 2 or 3, got %lli", lv->cell_count - 1);
+
+    lispvalue* condition = lispvalue_eval_borrowed(vm, le, lv->cells[1]);
+    if (condition->type == LISPVALUE_ERROR) return condition;
+
+    int taken = lispvalue_truthy(condition) ? 2 : 3;
+    lispvalue_delete(condition);
+
+    // only the taken branch is evaluated, a missing else branch gives an empty expression
+    if (taken == lv->cell_count) return lispvalue_sexpression();
+    return lispvalue_eval_branch(vm, le, lv->cells[taken]);
+}
+
+static lispvalue* lispvalue_eval_let(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    if (lv->cell_count < 2)
+    return lispvalue_error("special form \"let\" passed in no bindings");
+
+    lispvalue* bindings = lv->cells[1];
+
+    if (bindings->type != LISPVALUE_QEXPRESSION && bindings->type != LISPVALUE_SEXPRESSION)
+    return lispvalue_error("special form \"let\" passed in an incorrect type for its bindings: "
+    "expected %s, got %s", lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(bindings->type));
+
+    if (bindings->cell_count % 2)
+    return lispvalue_error("special form \"let\" received a symbol without a value");
+
+    for (int i = 0; i < bindings->cell_count; i += 2)
+    if (bindings->cells[i]->type != LISPVALUE_SYMBOL)
+    return lispvalue_error("special form \"let\" cannot bind non-symbol: "
+    "expected %s, got %s", lv_type_to_name(LISPVALUE_SYMBOL), lv_type_to_name(bindings->cells[i]->type));
+
+    // bindings are made one after another, so later values can refer to earlier symbols
+    lispenv* env = lispenv_new();
+    env->parent = le;
+
+    lispvalue* result = NULL;
+
+    for (int i = 0; i < bindings->cell_count && !result; i += 2)
+    {
+        lispvalue* value = lispvalue_eval_borrowed(vm, env, bindings->cells[i + 1]);
+
+        if (value->type == LISPVALUE_ERROR) result = value;
+        else lispenv_bind(env, bindings->cells[i]->symbol, value);
     }
 
-    // call builtin with operator
-    lispvalue* result = lispvalue_call(le, function, lv);
-    lispvalue_delete(function);
+    if (!result) result = lispvalue_eval_sequence(vm, env, lv, 2);
+
+    lispenv_delete(env);
+
     return result;
+}
+
+// "and" returns the first false value and "or" the first true value, otherwise the last value
+static lispvalue* lispvalue_eval_logical(lispvm* vm, lispenv* le, lispvalue* lv, int stop_when)
+{
+    if (lv->cell_count == 1) return lispvalue_number(!stop_when);
+
+    for (int i = 1; i < lv->cell_count; i++)
+    {
+        lispvalue* x = lispvalue_eval_borrowed(vm, le, lv->cells[i]);
+
+        if (x->type == LISPVALUE_ERROR || i == lv->cell_count - 1) return x;
+        if (lispvalue_truthy(x) == stop_when) return x;
+
+        lispvalue_delete(x);
+    }
+
+    return lispvalue_sexpression();
+}
+
+static lispvalue* lispvalue_eval_cond(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    for (int i = 1; i < lv->cell_count; i++)
+    {
+        lispvalue* clause = lv->cells[i];
+
+        if ((clause->type != LISPVALUE_QEXPRESSION && clause->type != LISPVALUE_SEXPRESSION)
+        || clause->cell_count == 0)
+        return lispvalue_error("special form \"cond\" passed in an invalid clause %i: "
+        "expected a non-empty %s", i, lv_type_to_name(LISPVALUE_QEXPRESSION));
+
+        lispvalue* condition = lispvalue_eval_borrowed(vm, le, clause->cells[0]);
+        if (condition->type == LISPVALUE_ERROR) return condition;
+
+        if (!lispvalue_truthy(condition))
+        {
+            lispvalue_delete(condition);
+            continue;
+        }
+
+        // a clause with only a condition gives the condition's value
+        if (clause->cell_count == 1) return condition;
+
+        lispvalue_delete(condition);
+
+        if (clause->cell_count == 2) return lispvalue_eval_branch(vm, le, clause->cells[1]);
+        return lispvalue_eval_sequence(vm, le, clause, 1);
+    }
+
+    return lispvalue_sexpression();
+}
+
+static lispvalue* lispvalue_eval_while(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    if (lv->cell_count < 2)
+    return lispvalue_error("special form \"while\" passed in no condition");
+
+    while (1)
+    {
+        lispvalue* condition = lispvalue_eval_borrowed(vm, le, lv->cells[1]);
+        if (condition->type == LISPVALUE_ERROR) return condition;
+
+        int running = lispvalue_truthy(condition);
+        lispvalue_delete(condition);
+
+        if (!running) return lispvalue_sexpression();
+
+        for (int i = 2; i < lv->cell_count; i++)
+        {
+            lispvalue* x = lispvalue_eval_borrowed(vm, le, lv->cells[i]);
+            if (x->type == LISPVALUE_ERROR) return x;
+            lispvalue_delete(x);
+        }
+    }
+}
+
+// "dotimes" and "for-range" count a symbol over a range of numbers,
+// the loop runs in a single environment and updates the symbol's value in place each iteration
+static lispvalue* lispvalue_eval_range(lispvm* vm, lispenv* le, lispvalue* lv, char* name, int min_bounds, int max_bounds)
+{
+    if (lv->cell_count < 2)
+    return lispvalue_error("special form \"%s\" passed in no range", name);
+
+    lispvalue* range = lv->cells[1];
+
+    if (range->type != LISPVALUE_QEXPRESSION && range->type != LISPVALUE_SEXPRESSION)
+    return lispvalue_error("special form \"%s\" passed in an incorrect type for its range: "
+    "expected %s, got %s", name, lv_type_to_name(LISPVALUE_QEXPRESSION), lv_type_to_name(range->type));
+
+    if (range->cell_count < 1 + min_bounds || range->cell_count > 1 + max_bounds)
+    return lispvalue_error("special form \"%s\" passed in an incorrect number of bounds: "
+    "expected %i to %i, got %lli", name, min_bounds, max_bounds, range->cell_count - 1);
+
+    if (range->cells[0]->type != LISPVALUE_SYMBOL)
+    return lispvalue_error("special form \"%s\" cannot count non-symbol: "
+    "expected %s, got %s", name, lv_type_to_name(LISPVALUE_SYMBOL), lv_type_to_name(range->cells[0]->type));
+
+    // bounds are start, end and step, with a single bound being the end
+    int64_t bounds[3] = { 0, 0, 1 };
+    int first = range->cell_count == 2 ? 1 : 0;
+
+    for (int i = 1; i < range->cell_count; i++)
+    {
+        lispvalue* x = lispvalue_eval_borrowed(vm, le, range->cells[i]);
+        if (x->type == LISPVALUE_ERROR) return x;
+
+        if (x->type != LISPVALUE_NUMBER)
+        {
+            lispvalue* error = lispvalue_error("special form \"%s\" passed in a non-number bound: "
+            "got %s", name, lv_type_to_name(x->type));
+            lispvalue_delete(x);
+            return error;
+        }
+
+        bounds[first + i - 1] = x->number;
+        lispvalue_delete(x);
+    }
+
+    if (!bounds[2]) return lispvalue_error("special form \"%s\" passed in a step of zero", name);
+
+    lispenv* env = lispenv_new();
+    env->parent = le;
+
+    lispvalue* counter = lispvalue_number(bounds[0]);
+    lispenv_bind(env, range->cells[0]->symbol, counter);
+
+    lispvalue* result = NULL;
+
+    for (int64_t i = bounds[0]; !result && (bounds[2] > 0 ? i < bounds[1] : i > bounds[1]); i += bounds[2])
+    {
+        counter->number = i;
+
+        for (int j = 2; j < lv->cell_count; j++)
+        {
+            lispvalue* x = lispvalue_eval_borrowed(vm, env, lv->cells[j]);
+
+            if (x->type == LISPVALUE_ERROR)
+            {
+                result = x;
+                break;
+            }
+
+            lispvalue_delete(x);
+        }
+    }
+
+    lispenv_delete(env);
+
+    return result ? result : lispvalue_sexpression();
+}
+
+// the expression is not evaluated until the promise is forced
+static lispvalue* lispvalue_eval_delay(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    if (lv->cell_count != 2)
+    return lispvalue_error("special form \"delay\" passed in an incorrect number of arguments: "
+    "expected 1, got %lli", lv->cell_count - 1);
+
+    return lispvalue_promise(lisppromise_delay(le, lv->cells[1]));
+}
+
+lispvalue* lispvalue_eval_special(lispvm* vm, lispenv* le, lispvalue* lv)
+{
+    switch (lv->cells[0]->special)
+    {
+        case SPECIAL_IF:    return lispvalue_eval_if(vm, le, lv);
+        case SPECIAL_LET:   return lispvalue_eval_let(vm, le, lv);
+        case SPECIAL_DO:    return lispvalue_eval_sequence(vm, le, lv, 1);
+        case SPECIAL_AND:   return lispvalue_eval_logical(vm, le, lv, 0);
+        case SPECIAL_OR:    return lispvalue_eval_logical(vm, le, lv, 1);
+        case SPECIAL_COND:  return lispvalue_eval_cond(vm, le, lv);
+        case SPECIAL_WHILE: return lispvalue_eval_while(vm, le, lv);
+        case SPECIAL_DOTIMES:   return lispvalue_eval_range(vm, le, lv, DOTIMES_STR, 1, 1);
+        case SPECIAL_FOR_RANGE: return lispvalue_eval_range(vm, le, lv, FOR_RANGE_STR, 2, 3);
+        case SPECIAL_DELAY:     return lispvalue_eval_delay(vm, le, lv);
+        default:            return lispvalue_error("unknown special form \"%s\"", lv->cells[0]->symbol);
+    }
 }
\ No newline at end of file
@@ -2,8 +2,24 @@
 
 #include "definitions.h"
 
-// function to call user-defined functions
-lispvalue* lispvalue_call(lispenv* le, lispvalue* function, lispvalue* lv);
+// function to call functions with arguments packed into an s_expression, which it deletes
+lispvalue* lispvalue_call(lispvm* vm, lispenv* le, lispvalue* function, lispvalue* lv);
 
-lispvalue* lispvalue_eval(lispenv* le, lispvalue* lv);
-lispvalue* lispvalue_eval_sexpression(lispenv* le, lispvalue* lv);
\ No newline at end of file
+// function to call functions with arguments on a stack owned by the caller,
+// the function and arguments are borrowed, see "lispprimitive" for taking ownership of arguments
+lispvalue* lispvalue_apply(lispvm* vm, lispenv* le, lispvalue* function, int argc, lispvalue** argv);
+
+// evaluates a lisp value and deletes it
+lispvalue* lispvalue_eval(lispvm* vm, lispenv* le, lispvalue* lv);
+
+// evaluates a lisp value without modifying or deleting it, returning a new value
+lispvalue* lispvalue_eval_borrowed(lispvm* vm, lispenv* le, lispvalue* lv);
+
+// evaluates the cells of an s_expression (or q_expression) without modifying or deleting it
+lispvalue* lispvalue_eval_sexpression(lispvm* vm, lispenv* le, lispvalue* lv);
+
+// evaluates a special form, choosing which of its cells to evaluate, without modifying or deleting it
+lispvalue* lispvalue_eval_special(lispvm* vm, lispenv* le, lispvalue* lv);
+
+// whether a value counts as true in a condition: non-zero numbers and non-empty expressions
+int lispvalue_truthy(lispvalue* lv);
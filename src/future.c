@@ -0,0 +1,73 @@
+#include <stdlib.h>
+
+#include "constdest.h"
+#include "evaluator.h"
+#include "vm.h"
+
+#include "future.h"
+
+static void lispfuture_run(lisptask* task)
+{
+    lispfuture* f = (lispfuture*)task;
+
+    int argc = f->arguments->cell_count;
+    lispvalue** argv = f->arguments->cells;
+
+    f->result = lispvalue_apply(f->vm, f->env, f->function, argc, argv);
+
+    // the function may have taken some of its arguments
+    for (int i = 0; i < argc; i++) if (argv[i]) lispvalue_delete(argv[i]);
+    f->arguments->cell_count = 0;
+
+    // the snapshot is only needed while running, the result may share caches with it but nothing runs in it any more
+    lispvalue_delete(f->arguments);
+    lispvalue_delete(f->function);
+    lispenv_delete(f->env);
+
+    f->arguments = NULL;
+    f->function = NULL;
+    f->env = NULL;
+}
+
+lispfuture* lispfuture_start(lispvm* vm, lispenv* le, lispvalue* function, int argc, lispvalue** argv)
+{
+    while (le->parent) le = le->parent;
+
+    lispfuture* f = malloc(sizeof(lispfuture));
+    atomic_init(&f->refs, 1);
+
+    f->vm = vm;
+    f->pool = lispvm_pool(vm);
+
+    f->env = lispenv_transfer(le);
+    f->function = lispvalue_transfer(function);
+    f->arguments = lispvalue_sexpression();
+    for (int i = 0; i < argc; i++) lispvalue_add(f->arguments, lispvalue_transfer(argv[i]));
+
+    f->result = NULL;
+
+    f->task.run = lispfuture_run;
+    lisppool_submit(f->pool, &f->task);
+
+    return f;
+}
+
+lispvalue* lispfuture_await(lispfuture* f)
+{
+    lisppool_wait(f->pool, &f->task);
+
+    // every copy of the future can await it, so each gets its own copy of the result
+    return lispvalue_transfer(f->result);
+}
+
+void lispfuture_delete(lispfuture* f)
+{
+    if (atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) != 1) return;
+
+    // the pool still points at the task until it is done
+    lisppool_wait(f->pool, &f->task);
+    lisppool_delete(f->pool);
+
+    lispvalue_delete(f->result);
+    free(f);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "definitions.h"
+#include "pool.h"
+
+// a function call running on the virtual machine's pool while its caller carries on,
+// shared by every copy of a future value
+typedef struct lispfuture
+{
+    lisptask task;
+    _Atomic(int64_t) refs;
+
+    lispvm* vm;
+
+    // the pool the task was submitted to, held until the future is deleted so resizing cannot free it
+    lisppool* pool;
+
+    // a snapshot of the caller's globals, so the caller may keep defining while the future runs,
+    // and the call, all transferred so they share nothing with the caller
+    lispenv* env;
+    lispvalue* function;
+    lispvalue* arguments;
+
+    // the completion slot, written by the task before it is marked done
+    lispvalue* result;
+} lispfuture;
+
+// starts calling "function" on the pool, the function and arguments are borrowed
+lispfuture* lispfuture_start(lispvm* vm, lispenv* le, lispvalue* function, int argc, lispvalue** argv);
+
+// waits for a future and returns a transferred copy of its result
+lispvalue* lispfuture_await(lispfuture* f);
+
+// deleting the last copy of a future waits for it to finish
+void lispfuture_delete(lispfuture* f);
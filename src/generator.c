@@ -0,0 +1,201 @@
+// for MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "constdest.h"
+#include "evaluator.h"
+
+#include "generator.h"
+
+// how much of a generator's stack is kept free, evaluation fails instead of going deeper
+#define GENERATOR_STACK_RESERVE (64 * 1024)
+
+// the generator's stack and the contexts to switch between it and whoever resumed it,
+// the stack is mapped below a guard page so that overflowing it faults instead of overwriting memory
+typedef struct lispcoroutine
+{
+    ucontext_t context;
+    ucontext_t caller;
+    char* mapping;
+    size_t mapped;
+    char* stack;
+} lispcoroutine;
+
+// the generator running on this thread, resuming one from inside another nests them
+static _Thread_local lispgenerator* current_generator = NULL;
+
+// its address identifies the thread that made a generator, it is unique among running threads and never NULL
+static _Thread_local char lispgenerator_thread;
+
+static void lispgenerator_main()
+{
+    lispgenerator* g = current_generator;
+
+    int argc = g->arguments->cell_count;
+    lispvalue** argv = g->arguments->cells;
+
+    lispvalue* result = lispvalue_apply(g->vm, g->env, g->function, argc, argv);
+
+    // the function may have taken some of its arguments
+    for (int i = 0; i < argc; i++) if (argv[i]) lispvalue_delete(argv[i]);
+    g->arguments->cell_count = 0;
+
+    // what the function returns is not one of the generated values, unless it is an error
+    if (result->type == LISPVALUE_ERROR && !g->cancelled) g->value = result;
+    else lispvalue_delete(result);
+
+    atomic_store(&g->state, GENERATOR_FINISHED);
+
+    // returning switches back to the caller through "uc_link"
+}
+
+lispgenerator* lispgenerator_new(lispvm* vm, lispenv* le, lispvalue* function, int argc, lispvalue** argv)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t mapped = page + (GENERATOR_STACK_SIZE + page - 1) / page * page;
+
+    char* mapping = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return NULL;
+
+    // stacks grow down, so the guard page is the lowest one
+    mprotect(mapping, page, PROT_NONE);
+
+    lispgenerator* g = malloc(sizeof(lispgenerator));
+    atomic_init(&g->refs, 1);
+    atomic_init(&g->state, GENERATOR_READY);
+
+    g->owner = &lispgenerator_thread;
+    g->vm = vm;
+    g->env = lispenv_capture(le);
+    g->function = lispvalue_copy(function);
+    g->arguments = lispvalue_sexpression();
+    for (int i = 0; i < argc; i++) lispvalue_add(g->arguments, lispvalue_copy(argv[i]));
+
+    g->value = NULL;
+    g->cancelled = 0;
+
+    lispcoroutine* co = malloc(sizeof(lispcoroutine));
+    co->mapping = mapping;
+    co->mapped = mapped;
+    co->stack = mapping + page;
+
+    getcontext(&co->context);
+    co->context.uc_stack.ss_sp = co->stack;
+    co->context.uc_stack.ss_size = mapped - page;
+    co->context.uc_link = &co->caller;
+    makecontext(&co->context, lispgenerator_main, 0);
+
+    g->coroutine = co;
+
+    return g;
+}
+
+// runs the generator until it yields or returns, 0 if it is already running
+static int lispgenerator_resume(lispgenerator* g)
+{
+    int state = atomic_load(&g->state);
+
+    if (state == GENERATOR_FINISHED) return 1;
+
+    if (state == GENERATOR_RUNNING
+    || !atomic_compare_exchange_strong(&g->state, &state, GENERATOR_RUNNING)) return 0;
+
+    lispgenerator* previous = current_generator;
+    current_generator = g;
+
+    swapcontext(&g->coroutine->caller, &g->coroutine->context);
+
+    current_generator = previous;
+    return 1;
+}
+
+void lispgenerator_delete(lispgenerator* g)
+{
+    if (atomic_fetch_sub_explicit(&g->refs, 1, memory_order_acq_rel) != 1) return;
+
+    // a suspended function still owns values on its stack, let it unwind normally
+    if (atomic_load(&g->state) == GENERATOR_SUSPENDED)
+    {
+        g->cancelled = 1;
+        if (g->value) lispvalue_delete(g->value);
+        g->value = NULL;
+
+        lispgenerator_resume(g);
+    }
+
+    if (g->value) lispvalue_delete(g->value);
+    lispvalue_delete(g->arguments);
+    lispvalue_delete(g->function);
+    lispenv_delete(g->env);
+
+    munmap(g->coroutine->mapping, g->coroutine->mapped);
+    free(g->coroutine);
+    free(g);
+}
+
+lispvalue* lispgenerator_next(lispgenerator* g)
+{
+    // the value is handed over without synchronisation, which is only safe on one thread
+    if (g->owner != &lispgenerator_thread)
+    return lispvalue_error("generator was made by another thread");
+
+    if (!g->value && !lispgenerator_resume(g))
+    return lispvalue_error("generator is already running");
+
+    if (!g->value) return lispvalue_error("generator is exhausted");
+
+    lispvalue* x = g->value;
+    g->value = NULL;
+
+    return x;
+}
+
+int lispgenerator_done(lispgenerator* g)
+{
+    if (g->owner != &lispgenerator_thread) return -2;
+
+    if (!g->value && !lispgenerator_resume(g)) return -1;
+
+    return !g->value;
+}
+
+lispvalue* lispgenerator_yield(lispvalue* lv)
+{
+    lispgenerator* g = current_generator;
+
+    if (!g)
+    {
+        lispvalue_delete(lv);
+        return NULL;
+    }
+
+    if (g->cancelled)
+    {
+        lispvalue_delete(lv);
+        return lispvalue_error("generator was deleted");
+    }
+
+    g->value = lv;
+    atomic_store(&g->state, GENERATOR_SUSPENDED);
+
+    swapcontext(&g->coroutine->context, &g->coroutine->caller);
+
+    // resumed by "next", "done" or the last copy being deleted
+    if (g->cancelled) return lispvalue_error("generator was deleted");
+    return lispvalue_sexpression();
+}
+
+int lispgenerator_stack_exhausted()
+{
+    lispgenerator* g = current_generator;
+    if (!g) return 0;
+
+    char here;
+    return (uintptr_t)&here < (uintptr_t)g->coroutine->stack + GENERATOR_STACK_RESERVE;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "definitions.h"
+
+// size of the stack each generator runs its function on, only the pages it touches are ever backed by memory,
+// evaluation fails with an error once it is nearly used up, so it limits how deep the function can recurse
+#ifndef GENERATOR_STACK_SIZE
+#define GENERATOR_STACK_SIZE (1024 * 1024)
+#endif
+
+enum GENERATOR_STATE
+{
+    GENERATOR_READY = 0,
+    GENERATOR_SUSPENDED,
+    GENERATOR_RUNNING,
+    GENERATOR_FINISHED
+};
+
+struct lispcoroutine;
+
+// a function call running on a stack of its own, which "yield" suspends to hand a value to "next",
+// shared by every copy of a generator value, only the thread that made a generator may resume it
+typedef struct lispgenerator
+{
+    _Atomic(int64_t) refs;
+    atomic_int state;
+
+    // identifies the thread that made the generator, parallel builtins share the globals it may be bound in
+    void* owner;
+
+    lispvm* vm;
+
+    // the caller's local bindings flattened into one environment on top of the global one,
+    // the frames they came from may be gone by the time the generator runs
+    lispenv* env;
+    lispvalue* function;
+    lispvalue* arguments;
+
+    // the value most recently yielded and not yet taken by "next", or the error the function failed with
+    lispvalue* value;
+
+    // set while the last copy is deleted, so each "yield" fails and the function unwinds
+    int cancelled;
+
+    struct lispcoroutine* coroutine;
+} lispgenerator;
+
+// makes a generator calling "function" once it is first resumed, the function and arguments are borrowed,
+// NULL if its stack cannot be allocated
+lispgenerator* lispgenerator_new(lispvm* vm, lispenv* le, lispvalue* function, int argc, lispvalue** argv);
+
+// deleting the last copy of a suspended generator resumes it to unwind its stack
+void lispgenerator_delete(lispgenerator* g);
+
+// the next value the generator yields, or an error once its function has returned
+// or if it is already running or was made by another thread
+lispvalue* lispgenerator_next(lispgenerator* g);
+
+// whether the generator's function has returned without yielding another value,
+// runs it up to its next "yield" to find out, -1 if the generator is already running
+// and -2 if another thread made it
+int lispgenerator_done(lispgenerator* g);
+
+// hands a value to whoever resumed the generator running on this thread and suspends it,
+// returns what "yield" evaluates to once resumed, or NULL if no generator is running
+lispvalue* lispgenerator_yield(lispvalue* lv);
+
+// whether the generator running on this thread, if any, has nearly used up its stack,
+// evaluation checks this so that recursing too deeply in a generator fails instead of overflowing it
+int lispgenerator_stack_exhausted();
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "definitions.h"
+
+// the mpc grammar of the language, which "lispvm_parse" parses with
+#define LISPVM_GRAMMAR "                                            \
+    "PROGRAM_STR"       : /^/ <"EXPRESSION_STR">* /$/ ;             \
+    "EXPRESSION_STR"    : <"NUMBER_STR"> | <"SYMBOL_STR">           \
+                        | <"SEXPRESSION_STR">                       \
+                        | <"QEXPRESSION_STR"> ;                     \
+    "SEXPRESSION_STR"   : '(' <"EXPRESSION_STR">* ')' ;             \
+    "QEXPRESSION_STR"   : '{' <"EXPRESSION_STR">* '}' ;             \
+    "SYMBOL_STR"        : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+/ ;       \
+    "NUMBER_STR"        : /-?[0-9]+/ ;                              \
+"
+
+// an image of the grammar, which tools/save_grammar.c builds and prints as grammar.c, so that
+// parsers are loaded from it instead of the grammar being parsed, regenerate it whenever the grammar
+// changes: an image of any other grammar is ignored, and the grammar parsed as before
+extern const unsigned char lispvm_grammar_image[];
+extern const size_t lispvm_grammar_image_length;
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+
+#include "constdest.h"
+#include "evaluator.h"
+#include "vm.h"
+
+#include "isolate.h"
+
+static int lispisolate_main(void* arg)
+{
+    lispisolate* i = arg;
+
+    int argc = i->arguments->cell_count;
+    lispvalue** argv = i->arguments->cells;
+
+    lispvalue* result = lispvalue_apply(i->vm, i->vm->env, i->function, argc, argv);
+
+    // the function may have taken some of its arguments
+    for (int j = 0; j < argc; j++) if (argv[j]) lispvalue_delete(argv[j]);
+    i->arguments->cell_count = 0;
+
+    mtx_lock(&i->lock);
+    i->result = result;
+    i->done = 1;
+    cnd_broadcast(&i->finished);
+    mtx_unlock(&i->lock);
+
+    lispisolate_delete(i);
+    return 0;
+}
+
+lispisolate* lispisolate_spawn(lispenv* le, lispvalue* function, int argc, lispvalue** argv)
+{
+    while (le->parent) le = le->parent;
+
+    lispisolate* i = malloc(sizeof(lispisolate));
+
+    // one reference for the caller and one for the thread
+    atomic_init(&i->refs, 2);
+
+    // the isolate starts with a copy of the spawning environment's globals, but none of its values
+    i->vm = lispvm_new();
+    lispenv_delete(i->vm->env);
+    i->vm->env = lispenv_transfer(le);
+
+    i->function = lispvalue_transfer(function);
+    i->arguments = lispvalue_sexpression();
+    for (int j = 0; j < argc; j++) lispvalue_add(i->arguments, lispvalue_transfer(argv[j]));
+
+    i->result = NULL;
+    i->done = 0;
+    mtx_init(&i->lock, mtx_plain);
+    cnd_init(&i->finished);
+
+    thrd_t thread;
+
+    if (thrd_create(&thread, lispisolate_main, i) != thrd_success)
+    {
+        atomic_store(&i->refs, 1);
+        lispisolate_delete(i);
+        return NULL;
+    }
+
+    thrd_detach(thread);
+    return i;
+}
+
+lispvalue* lispisolate_wait(lispisolate* i)
+{
+    mtx_lock(&i->lock);
+    while (!i->done) cnd_wait(&i->finished, &i->lock);
+    mtx_unlock(&i->lock);
+
+    // every copy of the isolate can wait on it, so each gets its own copy of the result
+    return lispvalue_transfer(i->result);
+}
+
+void lispisolate_delete(lispisolate* i)
+{
+    if (atomic_fetch_sub_explicit(&i->refs, 1, memory_order_acq_rel) != 1) return;
+
+    if (i->result) lispvalue_delete(i->result);
+    lispvalue_delete(i->arguments);
+    lispvalue_delete(i->function);
+    lispvm_delete(i->vm);
+
+    cnd_destroy(&i->finished);
+    mtx_destroy(&i->lock);
+    free(i);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "definitions.h"
+
+// a function running on its own thread in its own virtual machine, sharing no values with the one that
+// spawned it, only channels, shared by every copy of an isolate value and the thread running it
+typedef struct lispisolate
+{
+    _Atomic(int64_t) refs;
+
+    lispvm* vm;
+    lispvalue* function;
+    lispvalue* arguments;
+
+    // the function's result, set once "done" is
+    lispvalue* result;
+    int done;
+    mtx_t lock;
+    cnd_t finished;
+} lispisolate;
+
+// transfers "function" and "arguments" and the global environment of "le" into a new virtual machine
+// and calls the function on a new thread, returns NULL if the thread cannot be started
+lispisolate* lispisolate_spawn(lispenv* le, lispvalue* function, int argc, lispvalue** argv);
+
+// waits for an isolate to finish and returns a transferred copy of its result
+lispvalue* lispisolate_wait(lispisolate* i);
+
+void lispisolate_delete(lispisolate* i);
@@ -0,0 +1,82 @@
+#include "lispy.h"
+
+// evaluates the expressions of a program in order unless it could not be read,
+// returning the value of the last one or the first error
+static lispvalue* lispvm_eval_program(lispvm* vm, lispvalue* program)
+{
+    if (program->type == LISPVALUE_ERROR) return program;
+
+    lispvalue* result = lispvalue_sexpression();
+
+    for (int i = 0; i < program->cell_count; i++)
+    {
+        lispvalue_delete(result);
+
+        // each expression is moved out of the program as it is evaluated
+        result = lispvm_eval(vm, program->cells[i]);
+        program->cells[i] = NULL;
+
+        if (result->type == LISPVALUE_ERROR)
+        {
+            for (int j = i + 1; j < program->cell_count; j++) lispvalue_delete(program->cells[j]);
+            break;
+        }
+    }
+
+    program->cell_count = 0;
+    lispvalue_delete(program);
+
+    return result;
+}
+
+lispvalue* lispvm_eval_string(lispvm* vm, char* source)
+{
+    return lispvm_eval_program(vm, lispvm_read(vm, "<string>", source));
+}
+
+lispvalue* lispvm_eval_file(lispvm* vm, char* filename)
+{
+    return lispvm_eval_program(vm, lispvm_read(vm, filename, NULL));
+}
+
+void lispvm_register(lispvm* vm, char* name, lispprimitive function)
+{
+    lispenv_add_primitive(vm->env, name, function);
+}
+
+int8_t lispvalue_type(lispvalue* lv)
+{
+    return lv->type;
+}
+
+int lispvalue_is_error(lispvalue* lv)
+{
+    return lv->type == LISPVALUE_ERROR;
+}
+
+int64_t lispvalue_as_number(lispvalue* lv)
+{
+    return lv->type == LISPVALUE_NUMBER ? lv->number : 0;
+}
+
+char* lispvalue_as_string(lispvalue* lv)
+{
+    switch (lv->type)
+    {
+        case LISPVALUE_ERROR:   return lv->error;
+        case LISPVALUE_SYMBOL:  return lv->symbol;
+        default:                return NULL;
+    }
+}
+
+int64_t lispvalue_length(lispvalue* lv)
+{
+    if (lv->type != LISPVALUE_SEXPRESSION && lv->type != LISPVALUE_QEXPRESSION) return 0;
+    return lv->cell_count;
+}
+
+lispvalue* lispvalue_at(lispvalue* lv, int64_t i)
+{
+    if (i < 0 || i >= lispvalue_length(lv)) return NULL;
+    return lv->cells[i];
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// the interface for embedding lispy in another program, link against liblispy
+// (every source file but main.c, see the README) and include only this header
+
+#include "definitions.h"
+#include "constdest.h"
+#include "evaluator.h"
+#include "printer.h"
+#include "vm.h"
+
+// parses "source" as a program and evaluates its expressions in order in the virtual machine's global
+// environment, returning the value of the last one as a new value the caller deletes, evaluation stops
+// at the first error, and errors and parse failures are returned as error values
+lispvalue* lispvm_eval_string(lispvm* vm, char* source);
+
+// like "lispvm_eval_string" but reads the program from a file
+lispvalue* lispvm_eval_file(lispvm* vm, char* filename);
+
+// makes a C function callable from lisp code as "name", see "lispprimitive" for its calling convention,
+// errors are reported by returning "lispvalue_error"
+void lispvm_register(lispvm* vm, char* name, lispprimitive function);
+
+// functions to inspect values returned by the virtual machine without reaching into "lispvalue"
+int8_t lispvalue_type(lispvalue* lv);
+int lispvalue_is_error(lispvalue* lv);
+int64_t lispvalue_as_number(lispvalue* lv);
+
+// the message of an error or the name of a symbol, NULL for other values, owned by the value
+char* lispvalue_as_string(lispvalue* lv);
+
+// the number of cells in an s_expression or q_expression and the cell at index "i",
+// the cell is owned by the expression, 0 and NULL for other values or indices out of range
+int64_t lispvalue_length(lispvalue* lv);
+lispvalue* lispvalue_at(lispvalue* lv, int64_t i);
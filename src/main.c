@@ -13,45 +13,23 @@
 #include "constdest.h"
 #include "printer.h"
 #include "reader.h"
-#include "evaluator.h"
+#include "vm.h"
 
 // function to print the outcome of the parsed program
-void print(int outcome, mpc_result_t* result, lispenv* le);
+void print(int outcome, mpc_result_t* result, lispvm* vm);
+
+// function to read, evaluate and print a file, or "source" if it is not NULL
+void run(lispvm* vm, char* filename, char* source);
 
 int main(int argc, char** argv)
 {
     printf("Lispy Version 0.0.1\n");
     printf("type in \"q\" or \"quit\" to exit\n");
 
-    // create some parsers
-    mpc_parser_t* program       = mpc_new(PROGRAM_STR);
-    mpc_parser_t* expression    = mpc_new(EXPRESSION_STR);
-    mpc_parser_t* s_expression  = mpc_new(SEXPRESSION_STR);
-    mpc_parser_t* q_expression  = mpc_new(QEXPRESSION_STR);
-    mpc_parser_t* symbol        = mpc_new(SYMBOL_STR);
-    mpc_parser_t* number        = mpc_new(NUMBER_STR);
-
-    // define the grammar of the language
-    mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                               \
-        "PROGRAM_STR"       : /^/ <"EXPRESSION_STR">* /$/ ;         \
-        "EXPRESSION_STR"    : <"NUMBER_STR"> | <"SYMBOL_STR">       \
-                            | <"SEXPRESSION_STR">                   \
-                            | <"QEXPRESSION_STR"> ;                 \
-        "SEXPRESSION_STR"   : '(' <"EXPRESSION_STR">* ')' ;         \
-        "QEXPRESSION_STR"   : '{' <"EXPRESSION_STR">* '}' ;         \
-        "SYMBOL_STR"        : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;    \
-        "NUMBER_STR"        : /-?[0-9]+/ ;                          \
-    ",
-    program, expression, s_expression, q_expression, symbol, number);
-
-    mpc_result_t result;
-
-    lispenv* le = lispenv_new();
-    lispenv_add_builtins(le);
+    lispvm* vm = lispvm_new();
 
     // arguments provided are names to a file, so parse them
-    if (argc > 1) print(mpc_parse_contents(argv[1], program, &result), &result, le);
+    if (argc > 1) run(vm, argv[1], NULL);
 
     // else runs as an interpreter
     else
@@ -63,23 +41,56 @@ int main(int argc, char** argv)
             char* input = readline("lispy> ");
             add_history(input);
 
-            if (!strcmp(input, "quit") || !strcmp(input, "q")) break;
+            if (!strcmp(input, "quit") || !strcmp(input, "q"))
+            {
+                free(input);
+                break;
+            }
 
-            print(mpc_parse("lispy> ", input, program, &result), &result, le);
+            run(vm, "lispy> ", input);
 
             free(input);
         }
     }
 
-    lispenv_delete(le);
-
-    // clean up the parsers
-    mpc_cleanup(6, number, symbol, q_expression, s_expression, expression, program);
+    lispvm_delete(vm);
 
     return 0;
 }
 
-void print(int outcome, mpc_result_t* result, lispenv* le)
+void run(lispvm* vm, char* filename, char* source)
+{
+    // the mpc reader also shows the syntax tree it parsed
+    if (vm->reader == LISPVM_READER_MPC)
+    {
+        mpc_result_t result;
+        mpc_ast_arena_t* arena = mpc_ast_arena_new();
+        print(lispvm_parse(vm, filename, source, arena, &result), &result, vm);
+        mpc_ast_arena_delete(arena);
+        return;
+    }
+
+    lispvalue* lv = lispvm_read(vm, filename, source);
+
+    if (lv->type == LISPVALUE_ERROR)
+    {
+        printf("%s\n", lv->error);
+        lispvalue_delete(lv);
+        return;
+    }
+
+    printf("read as: ");
+    lispvalue_println(lv);
+
+    lv = lispvm_eval(vm, lv);
+
+    printf("evaluate as: ");
+    lispvalue_println(lv);
+
+    lispvalue_delete(lv);
+}
+
+void print(int outcome, mpc_result_t* result, lispvm* vm)
 {
     if (outcome)
     {
@@ -92,13 +103,12 @@ void print(int outcome, mpc_result_t* result, lispenv* le)
         printf("read as: ");
         lispvalue_println(lv);
 
-        lv = lispvalue_eval(le, lv);
+        lv = lispvm_eval(vm, lv);
 
         printf("evaluate as: ");
         lispvalue_println(lv);
 
         lispvalue_delete(lv);
-        mpc_ast_delete(result->output);
     }
 
     else
@@ -106,4 +116,4 @@ void print(int outcome, mpc_result_t* result, lispenv* le)
         mpc_err_print(result->error);
         mpc_err_delete(result->error);
     }
-}
\ No newline at end of file
+}
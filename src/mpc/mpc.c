@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 #include "mpc.h"
 
 /*
@@ -67,13 +69,100 @@ enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+/* Files and pipes are read this many bytes at a time */
+enum {
+  MPC_INPUT_BLOCK = 65536
+};
+
+/*
+** Parser temporaries up to MPC_MEM_CLASS_MAX bytes come from slabs owned by
+** the input, in size classes of 16, 32, 64, 128 and 256 bytes. Each block
+** starts with its class, freed blocks go on a free list per class, and the
+** slabs grow from MPC_INPUT_SLAB_MIN bytes by doubling. Everything is
+** released at once when the input is deleted, so anything that outlives
+** the parse is exported to the heap first. Deeply nested input keeps many
+** slabs in use, so they are also indexed by address to find the one a
+** pointer being freed is in.
+*/
+
+enum {
+  MPC_MEM_CLASSES    = 5,
+  MPC_MEM_CLASS_MIN  = 16,
+  MPC_MEM_CLASS_MAX  = 256,
+  MPC_INPUT_SLAB_MIN = 16384,
+  MPC_INPUT_SLAB_MAX = 1048576
+};
+
+typedef struct mpc_mem_slab_t {
+  struct mpc_mem_slab_t *next;
+  size_t size;
+  size_t used;
+} mpc_mem_slab_t;
+
+/*
+** Arenas trees are parsed into (see the AST section), and the packrat
+** table remembering what each named parser did at each position
+*/
+
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_AST_BLOCK_MIN = 65536,
+  MPC_AST_BLOCK_MAX = 4194304,
+  MPC_AST_TAGS_MIN  = 64
+};
+
+typedef struct mpc_ast_block_t {
+  struct mpc_ast_block_t *next;
+  size_t size;
+  size_t used;
+} mpc_ast_block_t;
+
+typedef struct {
+  const char *t;
+  const char *tag;
+  int root;
+  char *joined;
+} mpc_ast_intern_t;
+
+struct mpc_ast_arena_t {
+  mpc_ast_block_t *blocks;
+  mpc_ast_intern_t *tags;
+  size_t tags_num;
+  size_t tags_slots;
+  int packrat;
+  mpc_packrat_stats_t stats;
 };
 
+
+/*
+** What a parse records when it fails (see the Faults section), and the
+** result of running a parser, which holds one of those in place of an error
+*/
+
+typedef struct mpc_fault_t {
+  char type;
+  char received;
+  int n;
+  mpc_state_t state;
+  const char *message;
+  struct mpc_fault_t *x;
+  struct mpc_fault_t *next;
+} mpc_fault_t;
+
+typedef union {
+  mpc_fault_t *error;
+  mpc_val_t *output;
+} mpc_outcome_t;
+
 typedef struct {
-  char mem[64];
-} mpc_mem_t;
+  mpc_parser_t *parser;
+  long pos;
+  int success;
+  mpc_state_t state;
+  char last;
+  mpc_val_t *output;
+  mpc_fault_t *error;
+  mpc_fault_t *errors;
+} mpc_memo_t;
 
 typedef struct {
 
@@ -81,10 +170,21 @@ typedef struct {
   char *filename;
   mpc_state_t state;
 
-  char *string;
-  char *buffer;
+  const char *string;
+  long length;
   FILE *file;
 
+  /*
+  ** Files and pipes are read in blocks into a window starting at input
+  ** position "buffer_start", which keeps everything from the earliest
+  ** mark on so backtracking never has to seek or push characters back
+  */
+  char *buffer;
+  long buffer_start;
+  long buffer_length;
+  long buffer_slots;
+  long offset;
+
   int suppress;
   int backtrack;
   int marks_slots;
@@ -94,9 +194,14 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  mpc_mem_slab_t *slabs;
+  mpc_mem_slab_t **slabs_sorted;
+  long slabs_num;
+  char *mem_free[MPC_MEM_CLASSES];
+
+  mpc_ast_arena_t *arena;
+  mpc_memo_t *memo;
+  long memo_slots;
 
 } mpc_input_t;
 
@@ -110,10 +215,15 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
   i->state = mpc_state_new();
 
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
-  i->buffer = NULL;
+  /* The string is only read while the parse runs, so it is borrowed rather than copied */
+  i->string = string;
+  i->length = strlen(string);
   i->file = NULL;
+  i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_length = 0;
+  i->buffer_slots = 0;
+  i->offset = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -123,8 +233,14 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->slabs = NULL;
+  i->slabs_sorted = NULL;
+  i->slabs_num = 0;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+
+  i->arena = NULL;
+  i->memo = NULL;
+  i->memo_slots = 0;
 
   return i;
 }
@@ -139,11 +255,15 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
   i->state = mpc_state_new();
 
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
-  i->buffer = NULL;
+  /* Like a null-terminated string, the input ends at the first null character if it has one */
+  i->string = string;
+  i->length = length;
   i->file = NULL;
+  i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_length = 0;
+  i->buffer_slots = 0;
+  i->offset = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -153,8 +273,14 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->slabs = NULL;
+  i->slabs_sorted = NULL;
+  i->slabs_num = 0;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+
+  i->arena = NULL;
+  i->memo = NULL;
+  i->memo_slots = 0;
 
   return i;
 
@@ -171,8 +297,13 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
 
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
   i->file = pipe;
+  i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_length = 0;
+  i->buffer_slots = 0;
+  i->offset = 0;
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -182,8 +313,14 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->slabs = NULL;
+  i->slabs_sorted = NULL;
+  i->slabs_num = 0;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+
+  i->arena = NULL;
+  i->memo = NULL;
+  i->memo_slots = 0;
 
   return i;
 
@@ -199,8 +336,13 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
 
   i->string = NULL;
-  i->buffer = NULL;
+  i->length = 0;
   i->file = file;
+  i->buffer = NULL;
+  i->buffer_start = 0;
+  i->buffer_length = 0;
+  i->buffer_slots = 0;
+  i->offset = ftell(file);
 
   i->suppress = 0;
   i->backtrack = 1;
@@ -210,48 +352,114 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->slabs = NULL;
+  i->slabs_sorted = NULL;
+  i->slabs_num = 0;
+  memset(i->mem_free, 0, sizeof(i->mem_free));
+
+  i->arena = NULL;
+  i->memo = NULL;
+  i->memo_slots = 0;
 
   return i;
 }
 
 static void mpc_input_delete(mpc_input_t *i) {
 
+  mpc_mem_slab_t *slab;
+
   free(i->filename);
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  /*
+  ** Give back what files read ahead but did not consume by seeking. Pipes cannot
+  ** be given more than one character back portably, so what was read from them
+  ** stays with the parse and is dropped here
+  */
+  if (i->type == MPC_INPUT_FILE && i->offset >= 0) {
+    fseek(i->file, i->offset + i->state.pos, SEEK_SET);
+  }
+
+  free(i->buffer);
 
+  while (i->slabs) {
+    slab = i->slabs;
+    i->slabs = slab->next;
+    free(slab);
+  }
+
+  free(i->slabs_sorted);
   free(i->marks);
   free(i->lasts);
   free(i);
 }
 
+static int mpc_mem_in(mpc_mem_slab_t *slab, void *p) {
+  return (char*)p > (char*)(slab + 1) && (char*)p < (char*)(slab + 1) + slab->used;
+}
+
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+
+  long lo = 0, hi = i->slabs_num - 1, mid;
+
+  if (i->slabs && mpc_mem_in(i->slabs, p)) { return 1; }
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (mpc_mem_in(i->slabs_sorted[mid], p)) { return 1; }
+    if ((char*)p < (char*)i->slabs_sorted[mid]) { hi = mid - 1; } else { lo = mid + 1; }
+  }
+
+  return 0;
+}
+
+static void mpc_mem_index(mpc_input_t *i, mpc_mem_slab_t *slab) {
+  long j;
+  i->slabs_sorted = realloc(i->slabs_sorted, sizeof(mpc_mem_slab_t*) * (i->slabs_num + 1));
+  for (j = i->slabs_num; j > 0 && (char*)i->slabs_sorted[j-1] > (char*)slab; j--) {
+    i->slabs_sorted[j] = i->slabs_sorted[j-1];
+  }
+  i->slabs_sorted[j] = slab;
+  i->slabs_num++;
+}
+
+static size_t mpc_mem_size(void *p) {
+  return (size_t)MPC_MEM_CLASS_MIN << ((size_t*)p)[-1];
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
+
+  size_t k = 0, block, size;
+  mpc_mem_slab_t *slab;
   char *p;
 
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  if (n > MPC_MEM_CLASS_MAX) { return malloc(n); }
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  while (((size_t)MPC_MEM_CLASS_MIN << k) < n) { k++; }
+
+  if (i->mem_free[k]) {
+    p = i->mem_free[k];
+    i->mem_free[k] = *(char**)p;
+    return p;
+  }
+
+  block = sizeof(size_t) + ((size_t)MPC_MEM_CLASS_MIN << k);
+
+  if (!i->slabs || i->slabs->used + block > i->slabs->size) {
+    size = i->slabs ? i->slabs->size * 2 : MPC_INPUT_SLAB_MIN;
+    size = size < MPC_INPUT_SLAB_MAX ? size : MPC_INPUT_SLAB_MAX;
+    slab = malloc(sizeof(mpc_mem_slab_t) + size);
+    slab->next = i->slabs;
+    slab->size = size;
+    slab->used = 0;
+    i->slabs = slab;
+    mpc_mem_index(i, slab);
+  }
+
+  p = (char*)(i->slabs + 1) + i->slabs->used;
+  i->slabs->used += block;
 
-  return malloc(n);
+  *(size_t*)p = k;
+  return p + sizeof(size_t);
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -261,10 +469,11 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  size_t k;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  k = ((size_t*)p)[-1];
+  *(char**)p = i->mem_free[k];
+  i->mem_free[k] = p;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
@@ -273,9 +482,9 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
   if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
 
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
+  if (n > mpc_mem_size(p)) {
+    q = mpc_malloc(i, n);
+    memcpy(q, p, mpc_mem_size(p));
     mpc_free(i, p);
     return q;
   }
@@ -286,8 +495,8 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
   if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  q = malloc(mpc_mem_size(p));
+  memcpy(q, p, mpc_mem_size(p));
   mpc_free(i, p);
   return q;
 }
@@ -313,14 +522,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -335,14 +539,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -352,80 +548,52 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
 
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
-  }
-
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
-
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
-
-static char mpc_input_getc(mpc_input_t *i) {
+static int mpc_input_buffer_fill(mpc_input_t *i) {
 
-  char c = '\0';
+  long keep = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+  size_t n;
 
-  switch (i->type) {
+  if (feof(i->file) || ferror(i->file)) { return 0; }
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
+  /* Drop what nothing can rewind to any more */
+  if (keep > i->buffer_start) {
+    keep = keep < i->buffer_start + i->buffer_length ? keep : i->buffer_start + i->buffer_length;
+    memmove(i->buffer, i->buffer + (keep - i->buffer_start), i->buffer_length - (keep - i->buffer_start));
+    i->buffer_length -= keep - i->buffer_start;
+    i->buffer_start = keep;
+  }
 
-      if (!i->buffer) { c = getc(i->file); return c; }
+  if (i->buffer_length + MPC_INPUT_BLOCK > i->buffer_slots) {
+    i->buffer_slots = i->buffer_length + MPC_INPUT_BLOCK;
+    i->buffer = realloc(i->buffer, i->buffer_slots);
+  }
 
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+  n = fread(i->buffer + i->buffer_length, 1, MPC_INPUT_BLOCK, i->file);
+  i->buffer_length += n;
+  return n > 0;
+}
 
-    default: return c;
+static char mpc_input_buffer_get(mpc_input_t *i) {
+  while (i->state.pos - i->buffer_start >= i->buffer_length) {
+    if (!mpc_input_buffer_fill(i)) { return '\0'; }
   }
+  return i->buffer[i->state.pos - i->buffer_start];
 }
 
-static char mpc_input_peekc(mpc_input_t *i) {
-
-  char c = '\0';
-
+static char mpc_input_getc(mpc_input_t *i) {
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE:
-
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
-
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
-
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-    default: return c;
+    case MPC_INPUT_PIPE: return mpc_input_buffer_get(i);
+    default: return '\0';
   }
+}
 
+static char mpc_input_peekc(mpc_input_t *i) {
+  return mpc_input_getc(i);
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
@@ -433,34 +601,13 @@ static int mpc_input_terminated(mpc_input_t *i) {
 }
 
 static int mpc_input_failure(mpc_input_t *i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
-    default: { break; }
-  }
+  (void) i;
+  (void) c;
   return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
@@ -540,6 +687,83 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   return 1;
 }
 
+static void mpc_input_dfa_advance(mpc_input_t *i, const char *x, long n) {
+  long j;
+  for (j = 0; j < n; j++) {
+    i->state.col++;
+    if (x[j] == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+  i->state.pos += n;
+  if (n) { i->last = x[n-1]; }
+}
+
+static int mpc_input_dfa(mpc_input_t *i, const short *next, const char *accept, char **o) {
+
+  int s = 0, backtrack;
+  long n = 0, m = 0, accepted = accept[0] ? 0 : -1, length;
+  const char *y;
+  char c, *x = NULL;
+
+  /* Strings are matched in place */
+  if (i->type == MPC_INPUT_STRING) {
+
+    y = i->string + i->state.pos;
+    length = i->length - i->state.pos;
+    while (n < length && y[n] != '\0' && (s = next[s * 256 + (unsigned char)y[n]]) >= 0) {
+      n++;
+      if (accept[s]) { accepted = n; }
+    }
+
+    if (accepted < 0) { return 0; }
+
+    *o = mpc_malloc(i, accepted + 1);
+    memcpy(*o, y, accepted);
+    (*o)[accepted] = '\0';
+
+    mpc_input_dfa_advance(i, y, accepted);
+    return 1;
+  }
+
+  /* Otherwise read ahead as far as the DFA goes, then rewind and consume only what it accepted */
+  backtrack = i->backtrack;
+  i->backtrack = 1;
+  mpc_input_mark(i);
+
+  while (!mpc_input_terminated(i)) {
+    c = mpc_input_getc(i);
+    s = next[s * 256 + (unsigned char)c];
+    if (s < 0) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+
+    if (n + 1 >= m) {
+      m = m ? m * 2 : 16;
+      x = realloc(x, m);
+    }
+    x[n++] = c;
+    if (accept[s]) { accepted = n; }
+  }
+
+  mpc_input_rewind(i);
+
+  for (n = 0; n < accepted; n++) {
+    mpc_input_success(i, mpc_input_getc(i), NULL);
+  }
+
+  i->backtrack = backtrack;
+
+  if (accepted < 0) { free(x); return 0; }
+
+  *o = mpc_malloc(i, accepted + 1);
+  if (accepted) { memcpy(*o, x, accepted); }
+  (*o)[accepted] = '\0';
+
+  free(x);
+  return 1;
+}
+
 static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
   *o = NULL;
   return f(i->last, mpc_input_peekc(i));
@@ -662,33 +886,31 @@ char *mpc_err_string(mpc_err_t *x) {
   return realloc(buffer, strlen(buffer) + 1);
 }
 
-static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
+static mpc_err_t *mpc_err_new(mpc_input_t *i, mpc_fault_t *f) {
   mpc_err_t *x;
-  if (i->suppress) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
   x->filename = mpc_malloc(i, strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
-  x->state = i->state;
+  x->state = f->state;
   x->expected_num = 1;
   x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[0], expected);
+  x->expected[0] = mpc_malloc(i, strlen(f->message) + 1);
+  strcpy(x->expected[0], f->message);
   x->failure = NULL;
-  x->received = mpc_input_peekc(i);
+  x->received = f->received;
   return x;
 }
 
-static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
+static mpc_err_t *mpc_err_fail(mpc_input_t *i, mpc_fault_t *f) {
   mpc_err_t *x;
-  if (i->suppress) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
   x->filename = mpc_malloc(i, strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
-  x->state = i->state;
+  x->state = f->state;
   x->expected_num = 0;
   x->expected = NULL;
-  x->failure = mpc_malloc(i, strlen(failure) + 1);
-  strcpy(x->failure, failure);
+  x->failure = mpc_malloc(i, strlen(f->message) + 1);
+  strcpy(x->failure, f->message);
   x->received = ' ';
   return x;
 }
@@ -878,6 +1100,133 @@ static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
   return mpc_err_or(i, errs, 2);
 }
 
+/*
+** Faults
+**
+** Parsers that fail record a fault rather than an error: where they failed,
+** the character found there and the message they would give, which is
+** borrowed from the parser instead of copied. Nearly all of them are thrown
+** away again once some other alternative matches, so strings are only made
+** from them by "mpc_fault_error" if the whole parse fails. Merging faults
+** drops the one further back like merging errors does, and at the same
+** position keeps a list of the ones that differ, up to the first failure,
+** which is all merging their errors would look at.
+*/
+
+enum {
+  MPC_FAULT_EXPECTED = 0,
+  MPC_FAULT_FAILURE  = 1,
+  MPC_FAULT_MANY1    = 2,
+  MPC_FAULT_COUNT    = 3
+};
+
+static mpc_fault_t *mpc_fault_node(mpc_input_t *i, int type, mpc_state_t state, mpc_fault_t *x) {
+  mpc_fault_t *f = mpc_malloc(i, sizeof(mpc_fault_t));
+  f->type = type;
+  f->received = ' ';
+  f->n = 0;
+  f->state = state;
+  f->message = NULL;
+  f->x = x;
+  f->next = NULL;
+  return f;
+}
+
+static mpc_fault_t *mpc_fault_expected(mpc_input_t *i, const char *expected) {
+  mpc_fault_t *f;
+  if (i->suppress) { return NULL; }
+  f = mpc_fault_node(i, MPC_FAULT_EXPECTED, i->state, NULL);
+  f->received = mpc_input_peekc(i);
+  f->message = expected;
+  return f;
+}
+
+static mpc_fault_t *mpc_fault_failure(mpc_input_t *i, const char *failure) {
+  mpc_fault_t *f;
+  if (i->suppress) { return NULL; }
+  f = mpc_fault_node(i, MPC_FAULT_FAILURE, i->state, NULL);
+  f->message = failure;
+  return f;
+}
+
+static void mpc_fault_delete(mpc_input_t *i, mpc_fault_t *f) {
+  mpc_fault_t *next;
+  for (; f; f = next) {
+    next = f->next;
+    mpc_fault_delete(i, f->x);
+    mpc_free(i, f);
+  }
+}
+
+static int mpc_fault_same(mpc_fault_t *x, mpc_fault_t *y) {
+  if (x->type != y->type || x->n != y->n || x->message != y->message) { return 0; }
+  for (x = x->x, y = y->x; x && y; x = x->next, y = y->next) {
+    if (!mpc_fault_same(x, y)) { return 0; }
+  }
+  return x == y;
+}
+
+static mpc_fault_t *mpc_fault_merge(mpc_input_t *i, mpc_fault_t *x, mpc_fault_t *y) {
+
+  mpc_fault_t *next, **tail;
+
+  if (x == NULL) { return y; }
+  if (y == NULL) { return x; }
+  if (x->state.pos > y->state.pos) { mpc_fault_delete(i, y); return x; }
+  if (y->state.pos > x->state.pos) { mpc_fault_delete(i, x); return y; }
+
+  for (; y; y = next) {
+    next = y->next;
+    y->next = NULL;
+    for (tail = &x; *tail; tail = &(*tail)->next) {
+      if ((*tail)->type == MPC_FAULT_FAILURE || mpc_fault_same(*tail, y)) { break; }
+    }
+    if (*tail) { mpc_fault_delete(i, y); } else { *tail = y; }
+  }
+
+  return x;
+}
+
+static mpc_fault_t *mpc_fault_many1(mpc_input_t *i, mpc_fault_t *x) {
+  if (x == NULL) { return NULL; }
+  return mpc_fault_node(i, MPC_FAULT_MANY1, x->state, x);
+}
+
+static mpc_fault_t *mpc_fault_count(mpc_input_t *i, mpc_fault_t *x, int n) {
+  mpc_fault_t *f;
+  if (x == NULL) { return NULL; }
+  f = mpc_fault_node(i, MPC_FAULT_COUNT, x->state, x);
+  f->n = n;
+  return f;
+}
+
+static mpc_fault_t *mpc_fault_copy(mpc_input_t *i, mpc_fault_t *x) {
+  mpc_fault_t *y;
+  if (x == NULL) { return NULL; }
+  y = mpc_malloc(i, sizeof(mpc_fault_t));
+  *y = *x;
+  y->x = mpc_fault_copy(i, x->x);
+  y->next = mpc_fault_copy(i, x->next);
+  return y;
+}
+
+static mpc_err_t *mpc_fault_error(mpc_input_t *i, mpc_fault_t *f) {
+
+  mpc_err_t *e = NULL, *x = NULL;
+
+  for (; f; f = f->next) {
+    switch (f->type) {
+      case MPC_FAULT_EXPECTED: x = mpc_err_new(i, f); break;
+      case MPC_FAULT_FAILURE:  x = mpc_err_fail(i, f); break;
+      case MPC_FAULT_MANY1:    x = mpc_err_many1(i, mpc_fault_error(i, f->x)); break;
+      case MPC_FAULT_COUNT:    x = mpc_err_count(i, mpc_fault_error(i, f->x), f->n); break;
+    }
+    e = mpc_err_merge(i, e, x);
+  }
+
+  return e;
+}
+
 /*
 ** Parser Type
 */
@@ -918,7 +1267,9 @@ enum {
   MPC_TYPE_SOI        = 27,
   MPC_TYPE_EOI        = 28,
 
-  MPC_TYPE_SEPBY1     = 29
+  MPC_TYPE_SEPBY1     = 29,
+
+  MPC_TYPE_DFA        = 30
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -936,9 +1287,10 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_with_t f; void *d; ch
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; uint32_t *dispatch; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_parser_t *sep; } mpc_pdata_sepby1;
+typedef struct { int n; short *next; char *accept; } mpc_pdata_dfa_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -959,6 +1311,7 @@ typedef union {
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
   mpc_pdata_sepby1 sepby1;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -966,8 +1319,17 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  char flat;
+  int id;
 };
 
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *a, const char *tag, const char *contents, int n);
+static mpc_ast_t *mpc_ast_arena_own(mpc_ast_arena_t *a, mpc_ast_t *c);
+static mpc_val_t *mpc_ast_arena_fold(mpc_ast_arena_t *a, int n, mpc_val_t **xs);
+static mpc_val_t *mpc_ast_arena_add_root(mpc_ast_arena_t *a, mpc_val_t *x);
+static mpc_val_t *mpc_ast_arena_apply_to(mpc_ast_arena_t *a, mpc_apply_to_t f, mpc_val_t *x, void *d);
+static mpc_val_t *mpcf_ast_add_parser_tag(mpc_val_t *a, void *p);
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -991,6 +1353,7 @@ static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
 static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
+  if (i->arena && a) { a = mpc_ast_arena_own(i->arena, a); }
   a = mpc_ast_state(a, *s);
   mpc_free(i, s);
   (void) n;
@@ -999,6 +1362,7 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
 
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
+  if (i->arena && f == mpcf_fold_ast) { return mpc_ast_arena_fold(i->arena, n, xs); }
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
   if (f == mpcf_fst)       { return mpcf_fst(n, xs); }
   if (f == mpcf_snd)       { return mpcf_snd(n, xs); }
@@ -1018,7 +1382,7 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->arena ? mpc_ast_arena_node(i->arena, "", c, 0) : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
@@ -1026,328 +1390,715 @@ static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (i->arena && f == (mpc_apply_t)mpc_ast_add_root) { return mpc_ast_arena_add_root(i->arena, x); }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (i->arena
+  && (f == (mpc_apply_to_t)mpc_ast_tag
+  ||  f == (mpc_apply_to_t)mpc_ast_add_tag
+  ||  f == mpcf_ast_add_parser_tag)) { return mpc_ast_arena_apply_to(i->arena, f, x, d); }
   return f(mpc_export(i, x), d);
 }
 
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   if (d == free) { mpc_free(i, x); return; }
+  if (i->arena && d == (mpc_dtor_t)mpc_ast_delete) { return; }
   d(mpc_export(i, x));
 }
 
+/*
+** Packrat Parsing
+**
+** A named parser is looked up by its position in a direct mapped table
+** before it is run. Successes keep the value, which is only ever an arena
+** node and never changed once it is shared (see "mpc_ast_arena_own"), and
+** where the input got to. Failures keep their error, and both keep the
+** errors that were merged into the furthest error while running, so a
+** lookup reports exactly what running the parser again would have. Nothing
+** is remembered while errors are suppressed or backtracking is off, since
+** the same parser does something else there.
+*/
+
+static void mpc_memo_new(mpc_input_t *i, long entries) {
+  i->memo_slots = 1;
+  while (i->memo_slots * 2 <= entries) { i->memo_slots *= 2; }
+  i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+}
+
+static void mpc_memo_clear(mpc_input_t *i, mpc_memo_t *m) {
+  mpc_fault_delete(i, m->error);
+  mpc_fault_delete(i, m->errors);
+  m->parser = NULL;
+  m->error = NULL;
+  m->errors = NULL;
+}
+
+static void mpc_memo_delete(mpc_input_t *i) {
+  long j;
+  for (j = 0; j < i->memo_slots; j++) { mpc_memo_clear(i, &i->memo[j]); }
+  free(i->memo);
+  i->memo = NULL;
+}
+
+/*
+** The Parse Stack
+**
+** Parsers are run by a loop over a stack of frames rather than by calling
+** one another, so how deeply the input can nest is bounded by memory
+** instead of the C stack. A frame holds the parser, where its result and
+** errors go, how far through running it the loop has got (its "stage") and
+** the results of the parsers it has run so far. Frames are allocated in
+** chunks which never move, so children write straight into their parents.
+**
+** A parser started again at the same position, with nothing consumed in
+** between, will only ever start itself again, as happens in left recursive
+** grammars. So once the frames at one position reach a power of two from
+** MPC_STACK_LOOP_MIN up, they are searched for the new frame's parser, and
+** if it is found the parser fails instead of running.
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_PARSE_STACK_MIN = 4,
+  MPC_STACK_CHUNK     = 256,
+  MPC_STACK_LOOP_MIN  = 64
 };
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+typedef struct {
+  mpc_parser_t *p;
+  mpc_outcome_t *r;
+  mpc_fault_t **e;
+  int stage;
+  int j;
+  long pos;
+  long same;
+  uint32_t viable;
+  mpc_fault_t *dispatched;
+  mpc_memo_t *memo;
+  mpc_fault_t **up;
+  mpc_fault_t *errors;
+  mpc_outcome_t *results;
+  mpc_outcome_t results_stk[MPC_PARSE_STACK_MIN];
+} mpc_frame_t;
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+typedef struct {
+  mpc_frame_t **chunks;
+  long chunks_num;
+  long num;
+} mpc_stack_t;
 
-static mpc_result_t *mpc_grow_results(mpc_input_t *i, int j, mpc_result_t *results_stk, mpc_result_t *results){
-  mpc_result_t *tmp_results = results;
+static mpc_frame_t *mpc_stack_frame(mpc_stack_t *s, long k) {
+  return &s->chunks[k / MPC_STACK_CHUNK][k % MPC_STACK_CHUNK];
+}
 
-  if (j == MPC_PARSE_STACK_MIN) {
-    int results_slots = j + j / 2;
-    tmp_results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-    memcpy(tmp_results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-  } else if (j >= MPC_PARSE_STACK_MIN) {
-    int results_slots = j + j / 2;
-    tmp_results = mpc_realloc(i, tmp_results, sizeof(mpc_result_t) * results_slots);
+static mpc_frame_t *mpc_stack_push(mpc_input_t *i, mpc_stack_t *s, mpc_frame_t *parent, mpc_parser_t *p, mpc_outcome_t *r, mpc_fault_t **e) {
+
+  mpc_frame_t *f;
+
+  if (s->num % MPC_STACK_CHUNK) {
+    f = parent + 1;
+  } else {
+    if (s->num == s->chunks_num * MPC_STACK_CHUNK) {
+      s->chunks = realloc(s->chunks, sizeof(mpc_frame_t*) * (s->chunks_num + 1));
+      s->chunks[s->chunks_num++] = malloc(sizeof(mpc_frame_t) * MPC_STACK_CHUNK);
+    }
+    f = s->chunks[s->num / MPC_STACK_CHUNK];
   }
 
-  return tmp_results;
+  s->num++;
+  f->p = p;
+  f->r = r;
+  f->e = e;
+  f->stage = 0;
+  f->j = 0;
+  f->pos = i->state.pos;
+  f->same = parent && parent->pos == f->pos ? parent->same + 1 : 0;
+  f->memo = NULL;
+  return f;
+}
+
+static mpc_frame_t *mpc_stack_pop(mpc_stack_t *s, mpc_frame_t *f) {
+  s->num--;
+  if (s->num == 0) { return NULL; }
+  return s->num % MPC_STACK_CHUNK ? f - 1 : mpc_stack_frame(s, s->num-1);
+}
+
+static int mpc_stack_loops(mpc_stack_t *s, mpc_frame_t *f) {
+  long k;
+  if (f->same < MPC_STACK_LOOP_MIN || (f->same & (f->same - 1))) { return 0; }
+  for (k = s->num - 2; k >= s->num - 1 - f->same; k--) {
+    if (mpc_stack_frame(s, k)->p == f->p) { return 1; }
+  }
+  return 0;
 }
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+static void mpc_stack_delete(mpc_stack_t *s) {
+  long k;
+  for (k = 0; k < s->chunks_num; k++) { free(s->chunks[k]); }
+  free(s->chunks);
+}
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
+/* Returns what a frame's parser did if it is remembered, or -1 after setting the frame up to remember it */
+static int mpc_memo_lookup(mpc_input_t *i, mpc_frame_t *f) {
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  uintptr_t h = ((uintptr_t)f->p >> 4) ^ ((uintptr_t)f->pos * 2654435761u);
+  mpc_memo_t *m = &i->memo[h & (i->memo_slots - 1)];
+  mpc_packrat_stats_t *stats = &i->arena->stats;
+
+  stats->lookups++;
+
+  if (m->parser == f->p && m->pos == f->pos) {
+    stats->hits++;
+    *f->e = mpc_fault_merge(i, *f->e, mpc_fault_copy(i, m->errors));
+    if (!m->success) { f->r->error = mpc_fault_copy(i, m->error); return 0; }
+    i->state = m->state;
+    i->last = m->last;
+    f->r->output = m->output;
+    return 1;
   }
 
-  switch (p->type) {
+  f->memo = m;
+  f->up = f->e;
+  f->errors = NULL;
+  f->e = &f->errors;
+  return -1;
+}
 
-    /* Basic Parsers */
+static void mpc_memo_store(mpc_input_t *i, mpc_frame_t *f, int x) {
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
-    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+  mpc_memo_t *m = f->memo;
+  mpc_packrat_stats_t *stats = &i->arena->stats;
 
-    /* Other parsers */
+  if (m->parser) { stats->evictions++; mpc_memo_clear(i, m); }
+  stats->stores++;
 
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+  m->parser = f->p;
+  m->pos = f->pos;
+  m->success = x;
+  m->errors = mpc_fault_copy(i, f->errors);
 
-    /* Application Parsers */
+  if (x) {
+    m->state = i->state;
+    m->last = i->last;
+    m->output = f->r->output;
+  } else {
+    m->error = mpc_fault_copy(i, f->r->error);
+  }
 
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
+  *f->up = mpc_fault_merge(i, *f->up, f->errors);
+}
 
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
+static mpc_outcome_t *mpc_grow_results(mpc_input_t *i, int j, mpc_outcome_t *results_stk, mpc_outcome_t *results){
+  mpc_outcome_t *tmp_results = results;
 
-    case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e, depth+1)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  if (j == MPC_PARSE_STACK_MIN) {
+    int results_slots = j + j / 2;
+    tmp_results = mpc_malloc(i, sizeof(mpc_outcome_t) * results_slots);
+    memcpy(tmp_results, results_stk, sizeof(mpc_outcome_t) * MPC_PARSE_STACK_MIN);
+  } else if (j >= MPC_PARSE_STACK_MIN) {
+    int results_slots = j + j / 2;
+    tmp_results = mpc_realloc(i, tmp_results, sizeof(mpc_outcome_t) * results_slots);
+  }
 
-    case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e, depth+1)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  return tmp_results;
+}
+
+/*
+** Leaf parsers, and those mpc_optimise marks as "flat" because they only run
+** others which are unnamed and so cannot recurse, need no more C stack than
+** the grammar nests. They are run by calling instead of being given frames,
+** unless they are to be remembered.
+*/
+
+#define MPC_FLAT(x) \
+  if (x) { return 1; } \
+  else { r->error = NULL; return 0; }
+
+static int mpc_parse_flat(mpc_input_t *i, mpc_parser_t *p, mpc_outcome_t *r, mpc_fault_t **e) {
+
+  int j, k, n;
+  mpc_outcome_t results_stk[MPC_PARSE_STACK_MIN];
+  mpc_outcome_t *results;
+
+  if (i->memo && p->name && !i->suppress && i->backtrack > 0) { return -1; }
+
+  switch (p->type) {
+    case MPC_TYPE_ANY:     MPC_FLAT(mpc_input_any(i, (char**)&r->output));
+    case MPC_TYPE_SINGLE:  MPC_FLAT(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+    case MPC_TYPE_RANGE:   MPC_FLAT(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+    case MPC_TYPE_ONEOF:   MPC_FLAT(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_NONEOF:  MPC_FLAT(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_SATISFY: MPC_FLAT(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+    case MPC_TYPE_STRING:  MPC_FLAT(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_ANCHOR:  MPC_FLAT(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+    case MPC_TYPE_SOI:     MPC_FLAT(mpc_input_soi(i, (char**)&r->output));
+    case MPC_TYPE_EOI:     MPC_FLAT(mpc_input_eoi(i, (char**)&r->output));
+    case MPC_TYPE_DFA:     MPC_FLAT(mpc_input_dfa(i, p->data.dfa.next, p->data.dfa.accept, (char**)&r->output));
+
+    case MPC_TYPE_UNDEFINED: r->error = mpc_fault_failure(i, "Parser Undefined!"); return 0;
+    case MPC_TYPE_PASS:      r->output = NULL; return 1;
+    case MPC_TYPE_FAIL:      r->error = mpc_fault_failure(i, p->data.fail.m); return 0;
+    case MPC_TYPE_LIFT:      r->output = p->data.lift.lf(); return 1;
+    case MPC_TYPE_LIFT_VAL:  r->output = p->data.lift.x; return 1;
+    case MPC_TYPE_STATE:     r->output = mpc_input_state_copy(i); return 1;
+
+    case MPC_TYPE_APPLY:
+      if (!mpc_parse_flat(i, p->data.apply.x, r, e)) { return 0; }
+      r->output = mpc_parse_apply(i, p->data.apply.f, r->output);
+      return 1;
+
+    case MPC_TYPE_APPLY_TO:
+      if (!mpc_parse_flat(i, p->data.apply_to.x, r, e)) { return 0; }
+      r->output = mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d);
+      return 1;
 
     case MPC_TYPE_EXPECT:
       mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e, depth+1)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
+      j = mpc_parse_flat(i, p->data.expect.x, r, e);
+      mpc_input_suppress_disable(i);
+      if (!j) { r->error = mpc_fault_expected(i, p->data.expect.m); }
+      return j;
+
+    case MPC_TYPE_MANY:
+      results = results_stk;
+      for (j = 0; mpc_parse_flat(i, p->data.repeat.x, &results[j], e); j++) {
+        results = mpc_grow_results(i, j+1, results_stk, results);
       }
+      *e = mpc_fault_merge(i, *e, results[j].error);
+      r->output = mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
+      if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); }
+      return 1;
 
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
+    case MPC_TYPE_AND:
+      n = p->data.and.n;
+      if (n == 0) { r->output = NULL; return 1; }
+      results = n > MPC_PARSE_STACK_MIN ? mpc_malloc(i, sizeof(mpc_outcome_t) * n) : results_stk;
+      mpc_input_mark(i);
+      for (j = 0; j < n; j++) {
+        if (!mpc_parse_flat(i, p->data.and.xs[j], &results[j], e)) {
+          mpc_input_rewind(i);
+          for (k = 0; k < j; k++) {
+            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+          }
+          r->error = results[j].error;
+          if (n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); }
+          return 0;
+        }
       }
+      mpc_input_unmark(i);
+      r->output = mpc_parse_fold(i, p->data.and.f, n, (mpc_val_t**)results);
+      if (n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); }
+      return 1;
 
-    /* Optional Parsers */
+    default: return -1;
+  }
+}
 
-    /* TODO: Update Not Error Message */
+#undef MPC_FLAT
 
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+#define MPC_LEAF_TYPES \
+  ((((1ul << (MPC_TYPE_STRING + 1)) - 1) & ~(1ul << MPC_TYPE_EXPECT)) \
+   | 1ul << MPC_TYPE_SOI | 1ul << MPC_TYPE_EOI | 1ul << MPC_TYPE_DFA)
 
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+#define MPC_CALL(q, x, y, s) f->stage = s; cp = q; cr = x; ce = y; goto call
+#define MPC_SUCCESS(x) r->output = x; ok = 1; goto returned
+#define MPC_FAILURE(x) r->error = x; ok = 0; goto returned
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+
+/*
+** Each turn of the loop carries on with the frame on top of the stack. It
+** either pushes a frame for the next parser it runs, and is continued when
+** that returns with "ok" saying whether it matched, or it returns itself.
+*/
 
-    /* Repeat Parsers */
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *root, mpc_outcome_t *out, mpc_fault_t **errors) {
 
-    case MPC_TYPE_MANY:
+  int k, ok = 0;
+  mpc_stack_t stack = { NULL, 0, 0 };
+  mpc_frame_t *f;
+  mpc_parser_t *p, *cp;
+  mpc_outcome_t *r, *cr;
+  mpc_fault_t **e, **ce;
 
-      results = results_stk;
+  f = mpc_stack_push(i, &stack, NULL, root, out, errors);
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        results = mpc_grow_results(i, j, results_stk, results);
+  while (f) {
+
+    p = f->p;
+    r = f->r;
+
+    if (f->stage == 0) {
+      if (mpc_stack_loops(&stack, f)) {
+        MPC_FAILURE(mpc_fault_failure(i, "Left recursion detected!"));
       }
+      if (i->memo && p->name && !i->suppress && i->backtrack > 0) {
+        ok = mpc_memo_lookup(i, f);
+        if (ok >= 0) { goto returned; }
+      }
+    }
 
-      *e = mpc_err_merge(i, *e, results[j].error);
+  resume:
 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+    e = f->e;
 
-    case MPC_TYPE_MANY1:
+    switch (p->type) {
 
-      results = results_stk;
+      /* Basic Parsers */
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        results = mpc_grow_results(i, j, results_stk, results);
-      }
+      case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
+      case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+      case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+      case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
+      case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+      case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+      case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+      case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+      case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
+      case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+      case MPC_TYPE_DFA:     MPC_PRIMITIVE(mpc_input_dfa(i, p->data.dfa.next, p->data.dfa.accept, (char**)&r->output));
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
+      /* Other parsers */
 
-        *e = mpc_err_merge(i, *e, results[j].error);
+      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_fault_failure(i, "Parser Undefined!"));
+      case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_fault_failure(i, p->data.fail.m));
+      case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+      case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+      case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
 
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+      /* Application Parsers */
+
+      case MPC_TYPE_APPLY:
+        if (f->stage == 0) { MPC_CALL(p->data.apply.x, r, e, 1); }
+        if (ok) {
+          MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
+        } else {
+          MPC_FAILURE(r->output);
+        }
 
-   case MPC_TYPE_SEPBY1:
+      case MPC_TYPE_APPLY_TO:
+        if (f->stage == 0) { MPC_CALL(p->data.apply_to.x, r, e, 1); }
+        if (ok) {
+          MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
+        } else {
+          MPC_FAILURE(r->error);
+        }
 
-      results = results_stk;
+      case MPC_TYPE_CHECK:
+        if (f->stage == 0) { MPC_CALL(p->data.check.x, r, e, 1); }
+        if (ok) {
+          if (p->data.check.f(&r->output)) {
+            MPC_SUCCESS(r->output);
+          } else {
+            mpc_parse_dtor(i, p->data.check.dx, r->output);
+            MPC_FAILURE(mpc_fault_failure(i, p->data.check.e));
+          }
+        } else {
+          MPC_FAILURE(r->error);
+        }
+
+      case MPC_TYPE_CHECK_WITH:
+        if (f->stage == 0) { MPC_CALL(p->data.check_with.x, r, e, 1); }
+        if (ok) {
+          if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
+            MPC_SUCCESS(r->output);
+          } else {
+            mpc_parse_dtor(i, p->data.check.dx, r->output);
+            MPC_FAILURE(mpc_fault_failure(i, p->data.check_with.e));
+          }
+        } else {
+          MPC_FAILURE(r->error);
+        }
 
-      if(mpc_parse_run(i, p->data.sepby1.x, &results[j], e, depth+1)){
-        j++;
-        results = mpc_grow_results(i, j, results_stk, results);
+      case MPC_TYPE_EXPECT:
+        if (f->stage == 0) {
+          mpc_input_suppress_enable(i);
+          MPC_CALL(p->data.expect.x, r, e, 1);
+        }
+        mpc_input_suppress_disable(i);
+        if (ok) {
+          MPC_SUCCESS(r->output);
+        } else {
+          MPC_FAILURE(mpc_fault_expected(i, p->data.expect.m));
+        }
 
-        while (
-          mpc_parse_run(i, p->data.sepby1.sep, &results[j], e, depth+1) &&
-          mpc_parse_run(i, p->data.sepby1.x, &results[j], e, depth+1)
-        ) {
-          j++;
-          results = mpc_grow_results(i, j, results_stk, results);
+      case MPC_TYPE_PREDICT:
+        if (f->stage == 0) {
+          mpc_input_backtrack_disable(i);
+          MPC_CALL(p->data.predict.x, r, e, 1);
+        }
+        mpc_input_backtrack_enable(i);
+        if (ok) {
+          MPC_SUCCESS(r->output);
+        } else {
+          MPC_FAILURE(r->error);
         }
-      }
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
+      /* Optional Parsers */
 
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+      /* TODO: Update Not Error Message */
 
-    case MPC_TYPE_COUNT:
+      case MPC_TYPE_NOT:
+        if (f->stage == 0) {
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          MPC_CALL(p->data.not.x, r, e, 1);
+        }
+        if (ok) {
+          mpc_input_rewind(i);
+          mpc_input_suppress_disable(i);
+          mpc_parse_dtor(i, p->data.not.dx, r->output);
+          MPC_FAILURE(mpc_fault_expected(i, "opposite"));
+        } else {
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          MPC_SUCCESS(p->data.not.lf());
+        }
+
+      case MPC_TYPE_MAYBE:
+        if (f->stage == 0) { MPC_CALL(p->data.not.x, r, e, 1); }
+        if (ok) {
+          MPC_SUCCESS(r->output);
+        } else {
+          *e = mpc_fault_merge(i, *e, r->error);
+          MPC_SUCCESS(p->data.not.lf());
+        }
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+      /* Repeat Parsers */
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
-      }
+      case MPC_TYPE_MANY:
+
+        if (f->stage == 0) {
+          f->results = f->results_stk;
+        } else if (ok) {
+          f->j++;
+          f->results = mpc_grow_results(i, f->j, f->results_stk, f->results);
+        }
+
+        if (f->stage == 0 || ok) { MPC_CALL(p->data.repeat.x, &f->results[f->j], e, 1); }
+
+        *e = mpc_fault_merge(i, *e, f->results[f->j].error);
 
-      if (j == p->data.repeat.n) {
         MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
+          mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+          if (f->j >= MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+
+      case MPC_TYPE_MANY1:
+
+        if (f->stage == 0) {
+          f->results = f->results_stk;
+        } else if (ok) {
+          f->j++;
+          f->results = mpc_grow_results(i, f->j, f->results_stk, f->results);
         }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
 
-    /* Combinatory Parsers */
+        if (f->stage == 0 || ok) { MPC_CALL(p->data.repeat.x, &f->results[f->j], e, 1); }
 
-    case MPC_TYPE_OR:
+        if (f->j == 0) {
+          MPC_FAILURE(
+            mpc_fault_many1(i, f->results[f->j].error);
+            if (f->j >= MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+        } else {
+
+          *e = mpc_fault_merge(i, *e, f->results[f->j].error);
+
+          MPC_SUCCESS(
+            mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+            if (f->j >= MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+        }
+
+      /* Stage 1 follows an element, and stage 2 a separator */
 
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+      case MPC_TYPE_SEPBY1:
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+        if (f->stage == 0) {
+          f->results = f->results_stk;
+          MPC_CALL(p->data.sepby1.x, &f->results[f->j], e, 1);
+        }
+
+        if (f->stage == 2 && ok) { MPC_CALL(p->data.sepby1.x, &f->results[f->j], e, 1); }
+
+        if (f->stage == 1 && ok) {
+          f->j++;
+          f->results = mpc_grow_results(i, f->j, f->results_stk, f->results);
+          MPC_CALL(p->data.sepby1.sep, &f->results[f->j], e, 2);
+        }
 
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        if (f->j == 0) {
+          MPC_FAILURE(
+            mpc_fault_many1(i, f->results[f->j].error);
+            if (f->j >= MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
         } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
+          *e = mpc_fault_merge(i, *e, f->results[f->j].error);
+
+          MPC_SUCCESS(
+            mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+            if (f->j >= MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
         }
-      }
 
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      case MPC_TYPE_COUNT:
 
-    case MPC_TYPE_AND:
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+        if (f->stage == 0) {
+          f->results = p->data.repeat.n > MPC_PARSE_STACK_MIN
+            ? mpc_malloc(i, sizeof(mpc_outcome_t) * p->data.repeat.n)
+            : f->results_stk;
+        } else if (ok) {
+          f->j++;
+        }
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+        if (f->stage == 0 || (ok && f->j < p->data.repeat.n)) {
+          MPC_CALL(p->data.repeat.x, &f->results[f->j], e, 1);
+        }
 
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e, depth+1)) {
+        if (f->j == p->data.repeat.n) {
+          MPC_SUCCESS(
+            mpc_parse_fold(i, p->data.repeat.f, f->j, (mpc_val_t**)f->results);
+            if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+        } else {
+          for (k = 0; k < f->j; k++) {
+            mpc_parse_dtor(i, p->data.repeat.dx, f->results[k].output);
+          }
+          MPC_FAILURE(
+            mpc_fault_count(i, f->results[f->j].error, p->data.repeat.n);
+            if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+        }
+
+      /* Combinatory Parsers */
+
+      /*
+      ** Stage 1 tries only the alternatives that can start with the next
+      ** character, and stage 2 the rest in turn, which fail where the "or"
+      ** started without consuming anything, for the error all of them give
+      ** if none of the first lot match. Each alternative that fails keeps its
+      ** faults in its result until the end, so they are merged in the order
+      ** the alternatives are given whichever stage ran them.
+      */
+
+      case MPC_TYPE_OR:
+
+        if (f->stage == 0) {
+          if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+          f->results = p->data.or.n > MPC_PARSE_STACK_MIN
+            ? mpc_malloc(i, sizeof(mpc_outcome_t) * p->data.or.n)
+            : f->results_stk;
+          f->viable = p->data.or.dispatch ? p->data.or.dispatch[(unsigned char)mpc_input_peekc(i)] : 0;
+          f->dispatched = NULL;
+          f->stage = f->viable ? 1 : 2;
+          f->j = -1;
+        } else if (ok) {
+          for (k = 0; k < p->data.or.n; k++) {
+            if (k < f->j && (f->stage == 2 || ((f->viable >> k) & 1))) {
+              *e = mpc_fault_merge(i, *e, f->results[k].error);
+            } else if (k > f->j && f->stage == 2 && ((f->viable >> k) & 1)) {
+              mpc_fault_delete(i, f->results[k].error);
+            }
+          }
+          *e = mpc_fault_merge(i, *e, f->dispatched);
+          MPC_SUCCESS(f->results[f->j].output;
+            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+        } else {
+          f->results[f->j].error = mpc_fault_merge(i, f->dispatched, f->results[f->j].error);
+          f->dispatched = NULL;
+        }
+
+        if (f->stage == 1) {
+          do { f->j++; } while (f->j < p->data.or.n && !((f->viable >> f->j) & 1));
+          if (f->j < p->data.or.n) {
+            MPC_CALL(p->data.or.xs[f->j], &f->results[f->j], &f->dispatched, 1);
+          }
+          f->j = -1;
+        }
+
+        do { f->j++; } while (f->j < p->data.or.n && ((f->viable >> f->j) & 1));
+        if (f->j < p->data.or.n) {
+          MPC_CALL(p->data.or.xs[f->j], &f->results[f->j], &f->dispatched, 2);
+        }
+
+        for (k = 0; k < p->data.or.n; k++) {
+          *e = mpc_fault_merge(i, *e, f->results[k].error);
+        }
+
+        MPC_FAILURE(NULL;
+          if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+
+      case MPC_TYPE_AND:
+
+        if (f->stage == 0) {
+          if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+          f->results = p->data.or.n > MPC_PARSE_STACK_MIN
+            ? mpc_malloc(i, sizeof(mpc_outcome_t) * p->data.or.n)
+            : f->results_stk;
+          mpc_input_mark(i);
+          MPC_CALL(p->data.and.xs[f->j], &f->results[f->j], e, 1);
+        }
+
+        if (!ok) {
           mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+          for (k = 0; k < f->j; k++) {
+            mpc_parse_dtor(i, p->data.and.dxs[k], f->results[k].output);
           }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+          MPC_FAILURE(f->results[f->j].error;
+            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
         }
-      }
-      mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
 
-    /* End */
+        if (++f->j < p->data.and.n) {
+          MPC_CALL(p->data.and.xs[f->j], &f->results[f->j], e, 1);
+        }
 
-    default:
+        mpc_input_unmark(i);
+        MPC_SUCCESS(
+          mpc_parse_fold(i, p->data.and.f, f->j, (mpc_val_t**)f->results);
+          if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, f->results); });
+
+      /* End */
+
+      default:
 
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+        MPC_FAILURE(mpc_fault_failure(i, "Unknown Parser Type Id!"));
+    }
+
+  call:
+
+    if (cp->flat || ((1ul << cp->type) & MPC_LEAF_TYPES)) {
+      ok = mpc_parse_flat(i, cp, cr, ce);
+      if (ok >= 0) { goto resume; }
+    }
+    f = mpc_stack_push(i, &stack, f, cp, cr, ce);
+    continue;
+
+  returned:
+
+    if (f->memo) { mpc_memo_store(i, f, ok); }
+    f = mpc_stack_pop(&stack, f);
   }
 
-  return 0;
+  mpc_stack_delete(&stack);
+  return ok;
 
 }
 
+#undef MPC_LEAF_TYPES
+#undef MPC_CALL
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
+  mpc_outcome_t o;
+  mpc_fault_t *e = mpc_fault_failure(i, "Unknown Error");
   e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e, 0);
+  x = mpc_parse_run(i, p, &o, &e);
   if (x) {
-    mpc_err_delete_internal(i, e);
-    r->output = mpc_export(i, r->output);
+    mpc_fault_delete(i, e);
+    r->output = mpc_export(i, o.output);
   } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    e = mpc_fault_merge(i, e, o.error);
+    r->error = mpc_err_export(i, mpc_fault_error(i, e));
+    mpc_fault_delete(i, e);
   }
   return x;
 }
@@ -1368,6 +2119,17 @@ int mpc_nparse(const char *filename, const char *string, size_t length, mpc_pars
   return x;
 }
 
+int mpc_nparse_arena(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
+  i->arena = a;
+  if (a->packrat) { mpc_memo_new(i, a->packrat); }
+  x = mpc_parse_input(i, p, r);
+  if (i->memo) { mpc_memo_delete(i); }
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_file(filename, file);
@@ -1413,6 +2175,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.dispatch);
 
 }
 
@@ -1441,6 +2204,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       free(p->data.string.x);
       break;
 
+    case MPC_TYPE_DFA:
+      free(p->data.dfa.next);
+      free(p->data.dfa.accept);
+      break;
+
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
@@ -1513,6 +2281,12 @@ static mpc_parser_t *mpc_undefined(void) {
   p->retained = 0;
   p->type = MPC_TYPE_UNDEFINED;
   p->name = NULL;
+  p->id = 0;
+  return p;
+}
+
+mpc_parser_t *mpc_tag_id(mpc_parser_t *p, int id) {
+  p->id = id;
   return p;
 }
 
@@ -1534,6 +2308,8 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   p->retained = a->retained;
   p->type = a->type;
   p->data = a->data;
+  p->flat = a->flat;
+  p->id = a->id;
 
   if (a->name) {
     p->name = malloc(strlen(a->name)+1);
@@ -1554,6 +2330,13 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.string.x, a->data.string.x);
       break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.next = malloc(sizeof(short) * 256 * a->data.dfa.n);
+      memcpy(p->data.dfa.next, a->data.dfa.next, sizeof(short) * 256 * a->data.dfa.n);
+      p->data.dfa.accept = malloc(a->data.dfa.n);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.n);
+      break;
+
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
@@ -1585,6 +2368,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.dispatch) {
+        p->data.or.dispatch = malloc(256 * sizeof(uint32_t));
+        memcpy(p->data.or.dispatch, a->data.or.dispatch, 256 * sizeof(uint32_t));
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1618,6 +2405,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
 mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
   mpc_undefine_unretained(p, 1);
   p->type = MPC_TYPE_UNDEFINED;
+  p->flat = 0;
   return p;
 }
 
@@ -1626,10 +2414,12 @@ mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   if (p->retained) {
     p->type = a->type;
     p->data = a->data;
+    p->flat = a->flat;
   } else {
     mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
     p->type = a2->type;
     p->data = a2->data;
+    p->flat = 0;
     free(a2);
   }
 
@@ -1994,6 +2784,7 @@ mpc_parser_t *mpc_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.dispatch = NULL;
 
   va_start(va, n);
   for (i = 0; i < n; i++) {
@@ -2346,20 +3137,13 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+static char *mpc_re_range_new(const char *s, int comp) {
 
-  mpc_parser_t *out;
   size_t i, j;
   size_t start, end;
   const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
   char *range = calloc(1,1);
 
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  if (s[0] == '^' &&
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-
   for (i = comp; i < strlen(s); i++){
 
     /* Regex Range Escape */
@@ -2401,6 +3185,21 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
 
   }
 
+  return range;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+
+  mpc_parser_t *out;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range;
+
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  if (s[0] == '^' &&
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+
+  range = mpc_re_range_new(s, comp);
   out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
 
   free(x);
@@ -2409,44 +3208,234 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
-  return mpc_re_mode(re, MPC_RE_DEFAULT);
+/*
+** Regular Expression DFAs
+**
+** Regexes that are just a sequence of characters, ranges, escapes and dots,
+** each optionally followed by "*", "+" or "?", are compiled to a table of
+** DFA states matched in a single loop rather than a tree of combinators.
+**
+** The combinators repeat possessively and never give characters back, where
+** a DFA finds the longest match, so a regex is only compiled if they agree:
+** nothing a repetition or option matches may start what can follow it.
+** Everything else (groups, alternation, anchors, counts and the zero width
+** escapes) is left to the combinators.
+*/
+
+enum {
+  MPC_DFA_ITEMS_MAX  = 63,
+  MPC_DFA_STATES_MAX = 256
+};
+
+typedef struct {
+  unsigned char set[32];
+  char optional;
+  char repeat;
+} mpc_dfa_item_t;
+
+static void mpc_dfa_set_add(mpc_dfa_item_t *t, unsigned char c) { t->set[c / 8] |= 1 << (c % 8); }
+static int mpc_dfa_set_has(const mpc_dfa_item_t *t, unsigned char c) { return t->set[c / 8] & (1 << (c % 8)); }
+
+static void mpc_dfa_set_chars(mpc_dfa_item_t *t, const char *cs, int comp) {
+  int c;
+  if (!comp) {
+    for (; *cs; cs++) { mpc_dfa_set_add(t, *cs); }
+  } else {
+    for (c = 1; c < 256; c++) { if (!strchr(cs, (char)c)) { mpc_dfa_set_add(t, c); } }
+  }
 }
 
-mpc_parser_t *mpc_re_mode(const char *re, int mode) {
+/* Splits a regex into items, returning how many or -1 if it needs the combinators */
+static int mpc_dfa_items(const char *re, int mode, mpc_dfa_item_t *items) {
 
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
+  int n = 0, comp;
+  size_t j;
+  char *range, *inner;
 
-  Regex  = mpc_new("regex");
-  Term   = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base   = mpc_new("base");
-  Range  = mpc_new("range");
+  while (*re) {
 
-  mpc_define(Regex, mpc_and(2, mpcf_re_or,
-    Term,
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
-    (mpc_dtor_t)mpc_delete
-  ));
+    if (n == MPC_DFA_ITEMS_MAX) { return -1; }
+    memset(&items[n], 0, sizeof(mpc_dfa_item_t));
 
-  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+    switch (*re) {
 
-  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
-    Base,
-    mpc_or(5,
-      mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
-      mpc_pass()),
-    (mpc_dtor_t)mpc_delete
-  ));
+      case '(': case ')': case '|': case '^': case '$': case '{': return -1;
 
-  mpc_define(Base, mpc_or(4,
-    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
-    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
-    mpc_apply_to(mpc_escape(), mpcf_re_escape, &mode),
+      case '.':
+        mpc_dfa_set_chars(&items[n], (mode & MPC_RE_DOTALL) ? "" : "\n", 1);
+        re++;
+        break;
+
+      case '\\':
+        switch (re[1]) {
+          case '\0': return -1;
+          case 'a': mpc_dfa_set_add(&items[n], '\a'); break;
+          case 'f': mpc_dfa_set_add(&items[n], '\f'); break;
+          case 'n': mpc_dfa_set_add(&items[n], '\n'); break;
+          case 'r': mpc_dfa_set_add(&items[n], '\r'); break;
+          case 't': mpc_dfa_set_add(&items[n], '\t'); break;
+          case 'v': mpc_dfa_set_add(&items[n], '\v'); break;
+          case 'd': mpc_dfa_set_chars(&items[n], "0123456789", 0); break;
+          case 's': mpc_dfa_set_chars(&items[n], " \f\n\r\t\v", 0); break;
+          case 'w': mpc_dfa_set_chars(&items[n], "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", 0); break;
+          case 'b': case 'B': case 'A': case 'Z': case 'D': case 'S': case 'W': return -1;
+          default: mpc_dfa_set_add(&items[n], re[1]); break;
+        }
+        re += 2;
+        break;
+
+      case '[':
+        for (j = 1; re[j] && re[j] != ']'; j++) {
+          if (re[j] == '\\') { if (!re[++j]) { return -1; } }
+        }
+        if (re[j] != ']' || j == 1 || (j == 2 && re[1] == '^')) { return -1; }
+
+        inner = malloc(j);
+        memcpy(inner, re + 1, j - 1);
+        inner[j - 1] = '\0';
+        comp = inner[0] == '^';
+        range = mpc_re_range_new(inner, comp);
+        mpc_dfa_set_chars(&items[n], range, comp);
+        free(range);
+        free(inner);
+
+        re += j + 1;
+        break;
+
+      default:
+        mpc_dfa_set_add(&items[n], *re);
+        re++;
+        break;
+    }
+
+    switch (*re) {
+      case '*': items[n].optional = 1; items[n].repeat = 1; re++; break;
+      case '+': items[n].repeat = 1; re++; break;
+      case '?': items[n].optional = 1; re++; break;
+      case '{': return -1;
+    }
+
+    n++;
+  }
+
+  /* The characters a repetition or option matches may not start what follows it */
+  for (j = 0; j < (size_t)n; j++) {
+    size_t k;
+    if (!items[j].optional && !items[j].repeat) { continue; }
+    for (k = j + 1; k < (size_t)n; k++) {
+      for (comp = 0; comp < 32; comp++) {
+        if (items[j].set[comp] & items[k].set[comp]) { return -1; }
+      }
+      if (!items[k].optional) { break; }
+    }
+  }
+
+  return n;
+}
+
+/* The items that can be matched next once item "j" is reached, bit "n" meaning the regex has matched */
+static uint64_t mpc_dfa_closure(const mpc_dfa_item_t *items, int n, int j) {
+  uint64_t m = 0;
+  for (; j < n; j++) {
+    m |= (uint64_t)1 << j;
+    if (!items[j].optional) { return m; }
+  }
+  return m | ((uint64_t)1 << n);
+}
+
+static mpc_parser_t *mpc_re_dfa(const char *re, int mode) {
+
+  mpc_dfa_item_t items[MPC_DFA_ITEMS_MAX];
+  uint64_t states[MPC_DFA_STATES_MAX], m;
+  int n, j, k, c, states_num = 1;
+  short *next;
+  char *accept;
+  mpc_parser_t *p;
+
+  n = mpc_dfa_items(re, mode, items);
+  if (n < 0) { return NULL; }
+
+  next = malloc(sizeof(short) * 256 * MPC_DFA_STATES_MAX);
+  states[0] = mpc_dfa_closure(items, n, 0);
+
+  /* Subset construction, each state being the set of items that may match the next character */
+  for (j = 0; j < states_num; j++) {
+    next[j * 256] = -1;
+    for (c = 1; c < 256; c++) {
+
+      m = 0;
+      for (k = 0; k < n; k++) {
+        if (!(states[j] & ((uint64_t)1 << k)) || !mpc_dfa_set_has(&items[k], c)) { continue; }
+        m |= mpc_dfa_closure(items, n, k + 1);
+        if (items[k].repeat) { m |= (uint64_t)1 << k; }
+      }
+
+      if (!m) { next[j * 256 + c] = -1; continue; }
+
+      for (k = 0; k < states_num && states[k] != m; k++);
+      if (k == states_num) {
+        if (states_num == MPC_DFA_STATES_MAX) { free(next); return NULL; }
+        states[states_num++] = m;
+      }
+      next[j * 256 + c] = k;
+    }
+  }
+
+  accept = malloc(states_num);
+  for (j = 0; j < states_num; j++) {
+    accept[j] = (states[j] >> n) & 1;
+  }
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.n = states_num;
+  p->data.dfa.next = realloc(next, sizeof(short) * 256 * states_num);
+  p->data.dfa.accept = accept;
+  return mpc_expectf(p, "/%s/", re);
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  return mpc_re_mode(re, MPC_RE_DEFAULT);
+}
+
+mpc_parser_t *mpc_re_mode(const char *re, int mode) {
+
+  char *err_msg;
+  mpc_parser_t *err_out, *dfa;
+  mpc_result_t r;
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
+
+  /* Use a DFA where the regex can be compiled to one */
+  dfa = mpc_re_dfa(re, mode);
+  if (dfa) { return dfa; }
+
+  Regex  = mpc_new("regex");
+  Term   = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base   = mpc_new("base");
+  Range  = mpc_new("range");
+
+  mpc_define(Regex, mpc_and(2, mpcf_re_or,
+    Term,
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    (mpc_dtor_t)mpc_delete
+  ));
+
+  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+
+  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
+    Base,
+    mpc_or(5,
+      mpc_char('*'), mpc_char('+'), mpc_char('?'),
+      mpc_brackets(mpc_int(), free),
+      mpc_pass()),
+    (mpc_dtor_t)mpc_delete
+  ));
+
+  mpc_define(Base, mpc_or(4,
+    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
+    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
+    mpc_apply_to(mpc_escape(), mpcf_re_escape, &mode),
     mpc_apply_to(mpc_noneof(")|"), mpcf_re_escape, &mode)
   ));
 
@@ -2806,6 +3795,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     free(s);
   }
 
+  if (p->type == MPC_TYPE_DFA) { printf("<dfa>"); }
+
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
@@ -2962,6 +3953,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->tag = malloc(strlen(tag) + 1);
   strcpy(a->tag, tag);
+  a->tag_id = 0;
 
   a->contents = malloc(strlen(contents) + 1);
   strcpy(a->contents, contents);
@@ -3036,6 +4028,12 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   return a;
 }
 
+mpc_ast_t *mpc_ast_add_tag_id(mpc_ast_t *a, const char *t, int id) {
+  if (a == NULL) { return a; }
+  if (a->tag_id == 0) { a->tag_id = id; }
+  return mpc_ast_add_tag(a, t);
+}
+
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
@@ -3056,6 +4054,241 @@ mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   return a;
 }
 
+/*
+** AST Arenas
+**
+** Nodes are bumped out of blocks that double from MPC_AST_BLOCK_MIN bytes,
+** each with its children and contents right behind it, since a fold knows
+** how many children a node gets before building it. Nodes folded into a
+** parent are simply left behind. Tags are never copied: the grammar's own
+** strings are used as they are, and the combined tags "mpc_ast_add_tag" and
+** "mpc_ast_add_root_tag" would build are made once per pair of tags and
+** looked up by their pointers afterwards.
+*/
+
+mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *a = malloc(sizeof(mpc_ast_arena_t));
+  a->blocks = NULL;
+  a->tags = NULL;
+  a->tags_num = 0;
+  a->tags_slots = 0;
+  a->packrat = 0;
+  memset(&a->stats, 0, sizeof(mpc_packrat_stats_t));
+  return a;
+}
+
+void mpc_ast_arena_packrat(mpc_ast_arena_t *a, int entries) {
+  a->packrat = entries > 0 ? entries : 0;
+}
+
+mpc_packrat_stats_t mpc_ast_arena_packrat_stats(mpc_ast_arena_t *a) {
+  return a->stats;
+}
+
+void mpc_ast_arena_packrat_print(mpc_ast_arena_t *a) {
+  printf("Packrat Stats\n");
+  printf("=============\n");
+  printf("Lookups: %li\n", a->stats.lookups);
+  printf("Hits: %li (%.1f%%)\n", a->stats.hits,
+    a->stats.lookups ? 100.0 * a->stats.hits / a->stats.lookups : 0.0);
+  printf("Stores: %li\n", a->stats.stores);
+  printf("Evictions: %li\n", a->stats.evictions);
+}
+
+void mpc_ast_arena_delete(mpc_ast_arena_t *a) {
+
+  mpc_ast_block_t *b;
+
+  if (a == NULL) { return; }
+
+  while (a->blocks) {
+    b = a->blocks;
+    a->blocks = b->next;
+    free(b);
+  }
+
+  free(a->tags);
+  free(a);
+}
+
+static void *mpc_ast_arena_malloc(mpc_ast_arena_t *a, size_t n) {
+
+  size_t size;
+  mpc_ast_block_t *b;
+  char *p;
+
+  n = (n + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+  if (!a->blocks || a->blocks->used + n > a->blocks->size) {
+    size = a->blocks ? a->blocks->size * 2 : MPC_AST_BLOCK_MIN;
+    size = size < MPC_AST_BLOCK_MAX ? size : MPC_AST_BLOCK_MAX;
+    size = size > n ? size : n;
+    b = malloc(sizeof(mpc_ast_block_t) + size);
+    b->next = a->blocks;
+    b->size = size;
+    b->used = 0;
+    a->blocks = b;
+  }
+
+  p = (char*)(a->blocks + 1) + a->blocks->used;
+  a->blocks->used += n;
+  return p;
+}
+
+static size_t mpc_ast_intern_hash(const char *t, const char *tag, int root) {
+  uintptr_t h = (uintptr_t)t * 31 + (uintptr_t)tag;
+  return (size_t)(h ^ (h >> 7) ^ (h >> 17)) + (size_t)root;
+}
+
+static char *mpc_ast_arena_join(mpc_ast_arena_t *a, const char *t, const char *tag, int root) {
+
+  size_t j, k, l;
+  mpc_ast_intern_t *tags;
+  char *joined;
+
+  if (a->tags_num * 2 >= a->tags_slots) {
+    tags = a->tags;
+    k = a->tags_slots;
+    a->tags_slots = k ? k * 2 : MPC_AST_TAGS_MIN;
+    a->tags = calloc(a->tags_slots, sizeof(mpc_ast_intern_t));
+    for (j = 0; j < k; j++) {
+      if (!tags[j].joined) { continue; }
+      l = mpc_ast_intern_hash(tags[j].t, tags[j].tag, tags[j].root) & (a->tags_slots - 1);
+      while (a->tags[l].joined) { l = (l + 1) & (a->tags_slots - 1); }
+      a->tags[l] = tags[j];
+    }
+    free(tags);
+  }
+
+  j = mpc_ast_intern_hash(t, tag, root) & (a->tags_slots - 1);
+  while (a->tags[j].joined) {
+    if (a->tags[j].t == t && a->tags[j].tag == tag && a->tags[j].root == root) { return a->tags[j].joined; }
+    j = (j + 1) & (a->tags_slots - 1);
+  }
+
+  /* "t|tag" for an added tag, and "tag" behind "t" without its last character for a root tag */
+  l = root ? strlen(t) - 1 : strlen(t) + 1;
+  joined = mpc_ast_arena_malloc(a, l + strlen(tag) + 1);
+  memcpy(joined, t, l);
+  if (!root) { joined[l-1] = '|'; }
+  strcpy(joined + l, tag);
+
+  a->tags[j].t = t;
+  a->tags[j].tag = tag;
+  a->tags[j].root = root;
+  a->tags[j].joined = joined;
+  a->tags_num++;
+  return joined;
+}
+
+/* with packrat parsing a node may be shared, so it is copied before anything changes it */
+static mpc_ast_t *mpc_ast_arena_own(mpc_ast_arena_t *a, mpc_ast_t *c) {
+  mpc_ast_t *d;
+  if (!a->packrat) { return c; }
+  d = mpc_ast_arena_malloc(a, sizeof(mpc_ast_t));
+  *d = *c;
+  return d;
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *a, const char *tag, const char *contents, int n) {
+
+  size_t l = strlen(contents);
+  mpc_ast_t *r = mpc_ast_arena_malloc(a, sizeof(mpc_ast_t) + sizeof(mpc_ast_t*) * n + (l ? l + 1 : 0));
+
+  r->tag = (char*)tag;
+  r->tag_id = 0;
+  r->state = mpc_state_new();
+  r->children_num = n;
+  r->children = n ? (mpc_ast_t**)(r + 1) : NULL;
+
+  if (l) {
+    r->contents = (char*)(r + 1) + sizeof(mpc_ast_t*) * n;
+    memcpy(r->contents, contents, l + 1);
+  } else {
+    r->contents = (char*)"";
+  }
+
+  return r;
+}
+
+static mpc_val_t *mpc_ast_arena_fold(mpc_ast_arena_t *a, int n, mpc_val_t **xs) {
+
+  int i, j, k = 0, m = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r, *c;
+
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+
+  for (i = 0; i < n; i++) {
+    if (as[i] == NULL) { continue; }
+    m += as[i]->children_num >= 2 ? as[i]->children_num : 1;
+  }
+
+  r = mpc_ast_arena_node(a, ">", "", m);
+
+  for (i = 0; i < n; i++) {
+
+    if (as[i] == NULL) { continue; }
+
+    if (as[i]->children_num == 0) {
+      r->children[k++] = as[i];
+    } else if (as[i]->children_num == 1) {
+      c = mpc_ast_arena_own(a, as[i]->children[0]);
+      c->tag = mpc_ast_arena_join(a, as[i]->tag, c->tag, 1);
+      if (c->tag_id == 0) { c->tag_id = as[i]->tag_id; }
+      r->children[k++] = c;
+    } else {
+      for (j = 0; j < as[i]->children_num; j++) {
+        r->children[k++] = as[i]->children[j];
+      }
+    }
+
+  }
+
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+
+  return r;
+}
+
+static mpc_val_t *mpc_ast_arena_add_root(mpc_ast_arena_t *a, mpc_val_t *x) {
+
+  mpc_ast_t *r, *c = x;
+
+  if (c == NULL) { return c; }
+  if (c->children_num == 0) { return c; }
+  if (c->children_num == 1) { return c; }
+
+  r = mpc_ast_arena_node(a, ">", "", 1);
+  r->children[0] = c;
+  return r;
+}
+
+static mpc_val_t *mpc_ast_arena_apply_to(mpc_ast_arena_t *a, mpc_apply_to_t f, mpc_val_t *x, void *d) {
+
+  mpc_ast_t *c = x;
+  mpc_parser_t *q = d;
+
+  if (c == NULL) { return c; }
+
+  c = mpc_ast_arena_own(a, c);
+
+  if (f == (mpc_apply_to_t)mpc_ast_tag) {
+    c->tag = d;
+  } else if (f == (mpc_apply_to_t)mpc_ast_add_tag) {
+    c->tag = mpc_ast_arena_join(a, d, c->tag, 0);
+  } else {
+    if (c->tag_id == 0) { c->tag_id = q->id; }
+    c->tag = mpc_ast_arena_join(a, q->name, c->tag, 0);
+  }
+
+  return c;
+}
+
 static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
 
   int i;
@@ -3279,6 +4512,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
       mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
+      if (as[i]->children[0]->tag_id == 0) { as[i]->children[0]->tag_id = as[i]->tag_id; }
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
       for (j = 0; j < as[i]->children_num; j++) {
@@ -3323,6 +4557,11 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
   return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
 }
 
+static mpc_val_t *mpcf_ast_add_parser_tag(mpc_val_t *a, void *p) {
+  mpc_parser_t *q = p;
+  return mpc_ast_add_tag_id(a, q->name, q->id);
+}
+
 mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
@@ -3343,6 +4582,7 @@ mpc_parser_t *mpca_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.dispatch = NULL;
 
   va_start(va, n);
   for (i = 0; i < n; i++) {
@@ -3561,7 +4801,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpc_apply_to(p, mpcf_ast_add_parser_tag, p)));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -3893,74 +5133,926 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   return err;
 }
 
-static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
-
-  int i, total;
+/*
+** Grammar Images
+**
+** An image holds every parser a grammar reaches, as it is once the whole
+** grammar is built and optimised, so that loading it skips parsing the
+** language. Callbacks are saved as their place in "mpc_image_fns", which
+** lists mpc's own, so grammars made with others cannot be saved, though
+** those "mpca_lang" builds never are. An image records the flags and
+** language it was saved from, and loading one which does not match them,
+** or which was saved by another version of mpc, builds the grammar with
+** "mpca_lang" instead.
+*/
 
-  if (p->retained && !force) { return 0; }
+enum {
+  MPC_IMAGE_VERSION = 1
+};
 
-  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+typedef void (*mpc_image_fn_t)(void);
+
+static const mpc_image_fn_t mpc_image_fns[] = {
+  NULL,
+  (mpc_image_fn_t)free,
+  (mpc_image_fn_t)mpcf_dtor_null,
+  (mpc_image_fn_t)mpcf_ctor_null,
+  (mpc_image_fn_t)mpcf_ctor_str,
+  (mpc_image_fn_t)mpcf_free,
+  (mpc_image_fn_t)mpcf_int,
+  (mpc_image_fn_t)mpcf_hex,
+  (mpc_image_fn_t)mpcf_oct,
+  (mpc_image_fn_t)mpcf_float,
+  (mpc_image_fn_t)mpcf_strtriml,
+  (mpc_image_fn_t)mpcf_strtrimr,
+  (mpc_image_fn_t)mpcf_strtrim,
+  (mpc_image_fn_t)mpcf_escape,
+  (mpc_image_fn_t)mpcf_escape_regex,
+  (mpc_image_fn_t)mpcf_escape_string_raw,
+  (mpc_image_fn_t)mpcf_escape_char_raw,
+  (mpc_image_fn_t)mpcf_unescape,
+  (mpc_image_fn_t)mpcf_unescape_regex,
+  (mpc_image_fn_t)mpcf_unescape_string_raw,
+  (mpc_image_fn_t)mpcf_unescape_char_raw,
+  (mpc_image_fn_t)mpcf_null,
+  (mpc_image_fn_t)mpcf_fst,
+  (mpc_image_fn_t)mpcf_snd,
+  (mpc_image_fn_t)mpcf_trd,
+  (mpc_image_fn_t)mpcf_fst_free,
+  (mpc_image_fn_t)mpcf_snd_free,
+  (mpc_image_fn_t)mpcf_trd_free,
+  (mpc_image_fn_t)mpcf_all_free,
+  (mpc_image_fn_t)mpcf_strfold,
+  (mpc_image_fn_t)mpcf_fold_ast,
+  (mpc_image_fn_t)mpcf_str_ast,
+  (mpc_image_fn_t)mpcf_state_ast,
+  (mpc_image_fn_t)mpcf_ast_add_parser_tag,
+  (mpc_image_fn_t)mpc_ast_tag,
+  (mpc_image_fn_t)mpc_ast_add_tag,
+  (mpc_image_fn_t)mpc_ast_add_root,
+  (mpc_image_fn_t)mpc_ast_delete,
+  (mpc_image_fn_t)mpc_soft_delete,
+  (mpc_image_fn_t)mpc_boundary_anchor,
+  (mpc_image_fn_t)mpc_boundary_newline_anchor
+};
 
-  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+/* Tags "mpca_lang" gives its syntax tree nodes, which are not copied by the parsers using them */
+static const char *mpc_image_tags[] = { "string", "char", "regex" };
 
-  if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
-  if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
+enum {
+  MPC_IMAGE_FNS_NUM  = sizeof(mpc_image_fns) / sizeof(mpc_image_fns[0]),
+  MPC_IMAGE_TAGS_NUM = sizeof(mpc_image_tags) / sizeof(mpc_image_tags[0])
+};
 
-  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+typedef struct {
+  unsigned char *data;
+  size_t length;
+  size_t slots;
+  mpc_parser_t **parsers;
+  int parsers_num;
+  int failed;
+} mpc_image_out_t;
 
-  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_SEPBY1) {
-    total = 1;
-    total += mpc_nodecount_unretained(p->data.sepby1.x, 0);
-    total += mpc_nodecount_unretained(p->data.sepby1.sep, 0);
-    total += mpc_nodecount_unretained(p->data.sepby1.x, 0);
-    return total;
+typedef struct {
+  const unsigned char *data;
+  size_t length;
+  size_t pos;
+  int failed;
+  int parser;
+  char *owned;
+} mpc_image_in_t;
+
+static void mpc_image_put(mpc_image_out_t *o, int x) {
+  if (o->length == o->slots) {
+    o->slots = o->slots ? o->slots * 2 : 256;
+    o->data = realloc(o->data, o->slots);
   }
+  o->data[o->length++] = (unsigned char)x;
+}
 
-  if (p->type == MPC_TYPE_OR) {
-    total = 1;
-    for(i = 0; i < p->data.or.n; i++) {
-      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
-    }
-    return total;
+static void mpc_image_put_int(mpc_image_out_t *o, long x) {
+  uint32_t y = (uint32_t)x;
+  mpc_image_put(o, y & 0xFF);
+  mpc_image_put(o, (y >> 8) & 0xFF);
+  mpc_image_put(o, (y >> 16) & 0xFF);
+  mpc_image_put(o, (y >> 24) & 0xFF);
+}
+
+static void mpc_image_put_string(mpc_image_out_t *o, const char *s) {
+  size_t j, n;
+  if (s == NULL) { mpc_image_put_int(o, -1); return; }
+  n = strlen(s);
+  mpc_image_put_int(o, (long)n);
+  for (j = 0; j < n; j++) { mpc_image_put(o, s[j]); }
+}
+
+static void mpc_image_put_fn(mpc_image_out_t *o, mpc_image_fn_t f) {
+  int j;
+  for (j = 0; j < MPC_IMAGE_FNS_NUM; j++) {
+    if (mpc_image_fns[j] == f) { mpc_image_put(o, j); return; }
   }
+  o->failed = 1;
+  mpc_image_put(o, 0);
+}
 
-  if (p->type == MPC_TYPE_AND) {
-    total = 1;
-    for(i = 0; i < p->data.and.n; i++) {
-      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
-    }
-    return total;
+/* Parsers are numbered as they are first reached, and saved in that order */
+static void mpc_image_put_parser(mpc_image_out_t *o, mpc_parser_t *p) {
+  int j;
+  for (j = 0; j < o->parsers_num; j++) {
+    if (o->parsers[j] == p) { mpc_image_put_int(o, j); return; }
   }
+  o->parsers = realloc(o->parsers, sizeof(mpc_parser_t*) * (o->parsers_num + 1));
+  o->parsers[o->parsers_num] = p;
+  mpc_image_put_int(o, o->parsers_num++);
+}
 
-  return 1;
+static void mpc_image_put_data(mpc_image_out_t *o, mpc_parser_t *p) {
 
-}
+  int j;
 
-void mpc_stats(mpc_parser_t* p) {
-  printf("Stats\n");
-  printf("=====\n");
-  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
-}
+  switch (p->type) {
 
-static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+    case MPC_TYPE_FAIL: mpc_image_put_string(o, p->data.fail.m); break;
 
-  int i, n, m;
-  mpc_parser_t *t;
+    case MPC_TYPE_LIFT: mpc_image_put_fn(o, (mpc_image_fn_t)p->data.lift.lf); break;
+    case MPC_TYPE_LIFT_VAL: if (p->data.lift.x) { o->failed = 1; } break;
 
-  if (p->retained && !force) { return; }
+    case MPC_TYPE_ANCHOR:  mpc_image_put_fn(o, (mpc_image_fn_t)p->data.anchor.f); break;
+    case MPC_TYPE_SATISFY: mpc_image_put_fn(o, (mpc_image_fn_t)p->data.satisfy.f); break;
 
-  /* Optimise Subexpressions */
+    case MPC_TYPE_SINGLE: mpc_image_put(o, p->data.single.x); break;
+    case MPC_TYPE_RANGE:  mpc_image_put(o, p->data.range.x); mpc_image_put(o, p->data.range.y); break;
 
-  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0); }
-  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      mpc_image_put_string(o, p->data.string.x);
+      break;
+
+    case MPC_TYPE_DFA:
+      mpc_image_put_int(o, p->data.dfa.n);
+      for (j = 0; j < 256 * p->data.dfa.n; j++) {
+        mpc_image_put(o, (uint16_t)p->data.dfa.next[j] & 0xFF);
+        mpc_image_put(o, (uint16_t)p->data.dfa.next[j] >> 8);
+      }
+      for (j = 0; j < p->data.dfa.n; j++) { mpc_image_put(o, p->data.dfa.accept[j]); }
+      break;
+
+    case MPC_TYPE_APPLY:
+      mpc_image_put_parser(o, p->data.apply.x);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.apply.f);
+      break;
+
+    case MPC_TYPE_APPLY_TO:
+      mpc_image_put_parser(o, p->data.apply_to.x);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.apply_to.f);
+      if (p->data.apply_to.f == mpcf_ast_add_parser_tag) {
+        mpc_image_put_parser(o, p->data.apply_to.d);
+      } else if (p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_tag
+             ||  p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_tag) {
+        for (j = 0; j < MPC_IMAGE_TAGS_NUM; j++) {
+          if (strcmp(p->data.apply_to.d, mpc_image_tags[j]) == 0) { break; }
+        }
+        if (j == MPC_IMAGE_TAGS_NUM) { o->failed = 1; }
+        mpc_image_put(o, j);
+      } else if (p->data.apply_to.d) {
+        o->failed = 1;
+      }
+      break;
+
+    case MPC_TYPE_CHECK:
+      mpc_image_put_parser(o, p->data.check.x);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.check.dx);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.check.f);
+      mpc_image_put_string(o, p->data.check.e);
+      break;
+
+    case MPC_TYPE_CHECK_WITH:
+      mpc_image_put_parser(o, p->data.check_with.x);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.check_with.dx);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.check_with.f);
+      mpc_image_put_string(o, p->data.check_with.e);
+      if (p->data.check_with.d) { o->failed = 1; }
+      break;
+
+    case MPC_TYPE_EXPECT:
+      mpc_image_put_parser(o, p->data.expect.x);
+      mpc_image_put_string(o, p->data.expect.m);
+      break;
+
+    case MPC_TYPE_PREDICT: mpc_image_put_parser(o, p->data.predict.x); break;
+
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_image_put_parser(o, p->data.not.x);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.not.dx);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.not.lf);
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_image_put_int(o, p->data.repeat.n);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.repeat.f);
+      mpc_image_put_parser(o, p->data.repeat.x);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.repeat.dx);
+      break;
+
+    case MPC_TYPE_SEPBY1:
+      mpc_image_put_int(o, p->data.sepby1.n);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.sepby1.f);
+      mpc_image_put_parser(o, p->data.sepby1.x);
+      mpc_image_put_parser(o, p->data.sepby1.sep);
+      break;
+
+    case MPC_TYPE_OR:
+      mpc_image_put_int(o, p->data.or.n);
+      for (j = 0; j < p->data.or.n; j++) { mpc_image_put_parser(o, p->data.or.xs[j]); }
+      break;
+
+    case MPC_TYPE_AND:
+      mpc_image_put_int(o, p->data.and.n);
+      mpc_image_put_fn(o, (mpc_image_fn_t)p->data.and.f);
+      for (j = 0; j < p->data.and.n; j++) { mpc_image_put_parser(o, p->data.and.xs[j]); }
+      for (j = 0; j < p->data.and.n-1; j++) { mpc_image_put_fn(o, (mpc_image_fn_t)p->data.and.dxs[j]); }
+      break;
+
+    default: break;
+  }
+
+}
+
+/*
+** An image is its header, then whether each parser is named and by what,
+** then each parser's type, flatness, id and data, in which other parsers
+** are given by number and callbacks by their place in "mpc_image_fns".
+*/
+
+static unsigned char *mpc_image_save(int flags, const char *language, mpc_parser_t **ps, int n, size_t *length) {
+
+  int j;
+  mpc_image_out_t body = { NULL, 0, 0, NULL, 0, 0 };
+  mpc_image_out_t o = { NULL, 0, 0, NULL, 0, 0 };
+
+  for (j = 0; j < n; j++) {
+    if (ps[j] && ps[j]->retained) { mpc_image_put_parser(&body, ps[j]); }
+  }
+
+  body.length = 0;
+
+  for (j = 0; j < body.parsers_num; j++) {
+    mpc_image_put(&body, body.parsers[j]->type);
+    mpc_image_put(&body, body.parsers[j]->flat);
+    mpc_image_put_int(&body, body.parsers[j]->id);
+    mpc_image_put_data(&body, body.parsers[j]);
+  }
+
+  mpc_image_put(&o, 'm'); mpc_image_put(&o, 'p'); mpc_image_put(&o, 'c');
+  mpc_image_put(&o, MPC_IMAGE_VERSION);
+  mpc_image_put_int(&o, flags);
+  mpc_image_put_string(&o, language);
+  mpc_image_put_int(&o, body.parsers_num);
+
+  for (j = 0; j < body.parsers_num; j++) {
+    if (body.parsers[j]->retained && body.parsers[j]->name == NULL) { o.failed = 1; }
+    mpc_image_put_string(&o, body.parsers[j]->retained ? body.parsers[j]->name : NULL);
+  }
+
+  for (j = 0; j < (int)body.length; j++) { mpc_image_put(&o, body.data[j]); }
+
+  free(body.parsers);
+  free(body.data);
+
+  if (o.failed || body.failed) {
+    free(o.data);
+    return NULL;
+  }
+
+  *length = o.length;
+  return o.data;
+}
+
+static int mpc_image_get(mpc_image_in_t *in) {
+  if (in->pos >= in->length) { in->failed = 1; return 0; }
+  return in->data[in->pos++];
+}
+
+static long mpc_image_get_int(mpc_image_in_t *in) {
+  uint32_t y = 0;
+  y |= (uint32_t)mpc_image_get(in);
+  y |= (uint32_t)mpc_image_get(in) << 8;
+  y |= (uint32_t)mpc_image_get(in) << 16;
+  y |= (uint32_t)mpc_image_get(in) << 24;
+  return y > 0x7FFFFFFF ? -(long)(0xFFFFFFFF - y) - 1 : (long)y;
+}
+
+static char *mpc_image_get_string(mpc_image_in_t *in) {
+  char *s;
+  long n = mpc_image_get_int(in);
+  if (n < 0) { return NULL; }
+  if ((size_t)n > in->length - in->pos) { in->failed = 1; return NULL; }
+  s = malloc(n + 1);
+  memcpy(s, in->data + in->pos, n);
+  s[n] = '\0';
+  in->pos += n;
+  return s;
+}
+
+static mpc_image_fn_t mpc_image_get_fn(mpc_image_in_t *in) {
+  int j = mpc_image_get(in);
+  if (j >= MPC_IMAGE_FNS_NUM) { in->failed = 1; return NULL; }
+  return mpc_image_fns[j];
+}
+
+/* Unnamed parsers are run by just the one parser, numbered before them, as they are saved */
+static mpc_parser_t *mpc_image_get_parser(mpc_image_in_t *in, mpc_parser_t **ps, int n) {
+  long j = mpc_image_get_int(in);
+  if (j < 0 || j >= n) { in->failed = 1; return NULL; }
+  if (!ps[j]->retained) {
+    if (j <= in->parser || in->owned[j]) { in->failed = 1; return NULL; }
+    in->owned[j] = 1;
+  }
+  return ps[j];
+}
+
+static mpc_parser_t *mpc_image_get_named(mpc_image_in_t *in, mpc_parser_t **ps, int n) {
+  long j = mpc_image_get_int(in);
+  if (j < 0 || j >= n || !ps[j]->retained) { in->failed = 1; return NULL; }
+  return ps[j];
+}
+
+static int mpc_image_get_count(mpc_image_in_t *in) {
+  long n = mpc_image_get_int(in);
+  if (n < 0 || (size_t)n > in->length - in->pos) { in->failed = 1; return 0; }
+  return (int)n;
+}
+
+static void mpc_image_get_data(mpc_image_in_t *in, mpc_parser_t *p, mpc_parser_t **ps, int n) {
+
+  int j;
+  uint16_t x;
+
+  switch (p->type) {
+
+    case MPC_TYPE_FAIL: p->data.fail.m = mpc_image_get_string(in); break;
+
+    case MPC_TYPE_LIFT: p->data.lift.lf = (mpc_ctor_t)mpc_image_get_fn(in); break;
+    case MPC_TYPE_LIFT_VAL: p->data.lift.x = NULL; break;
+
+    case MPC_TYPE_ANCHOR:  p->data.anchor.f = (int(*)(char,char))mpc_image_get_fn(in); break;
+    case MPC_TYPE_SATISFY: p->data.satisfy.f = (int(*)(char))mpc_image_get_fn(in); break;
+
+    case MPC_TYPE_SINGLE: p->data.single.x = (char)mpc_image_get(in); break;
+    case MPC_TYPE_RANGE:
+      p->data.range.x = (char)mpc_image_get(in);
+      p->data.range.y = (char)mpc_image_get(in);
+      break;
+
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      p->data.string.x = mpc_image_get_string(in);
+      if (p->data.string.x == NULL) { in->failed = 1; }
+      break;
+
+    case MPC_TYPE_DFA:
+      p->data.dfa.n = mpc_image_get_count(in);
+      if (in->failed || (size_t)p->data.dfa.n * 513 > in->length - in->pos) { in->failed = 1; break; }
+      p->data.dfa.next = malloc(sizeof(short) * 256 * p->data.dfa.n);
+      p->data.dfa.accept = malloc(p->data.dfa.n);
+      for (j = 0; j < 256 * p->data.dfa.n; j++) {
+        x = (uint16_t)mpc_image_get(in);
+        x |= (uint16_t)(mpc_image_get(in) << 8);
+        p->data.dfa.next[j] = (short)x;
+        if (p->data.dfa.next[j] >= p->data.dfa.n) { in->failed = 1; }
+      }
+      for (j = 0; j < p->data.dfa.n; j++) { p->data.dfa.accept[j] = (char)mpc_image_get(in); }
+      break;
+
+    case MPC_TYPE_APPLY:
+      p->data.apply.x = mpc_image_get_parser(in, ps, n);
+      p->data.apply.f = (mpc_apply_t)mpc_image_get_fn(in);
+      break;
+
+    case MPC_TYPE_APPLY_TO:
+      p->data.apply_to.x = mpc_image_get_parser(in, ps, n);
+      p->data.apply_to.f = (mpc_apply_to_t)mpc_image_get_fn(in);
+      p->data.apply_to.d = NULL;
+      if (p->data.apply_to.f == mpcf_ast_add_parser_tag) {
+        p->data.apply_to.d = mpc_image_get_named(in, ps, n);
+      } else if (p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_tag
+             ||  p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_tag) {
+        j = mpc_image_get(in);
+        if (j >= MPC_IMAGE_TAGS_NUM) { in->failed = 1; break; }
+        p->data.apply_to.d = (void*)mpc_image_tags[j];
+      }
+      break;
+
+    case MPC_TYPE_CHECK:
+      p->data.check.x = mpc_image_get_parser(in, ps, n);
+      p->data.check.dx = (mpc_dtor_t)mpc_image_get_fn(in);
+      p->data.check.f = (mpc_check_t)mpc_image_get_fn(in);
+      p->data.check.e = mpc_image_get_string(in);
+      break;
+
+    case MPC_TYPE_CHECK_WITH:
+      p->data.check_with.x = mpc_image_get_parser(in, ps, n);
+      p->data.check_with.dx = (mpc_dtor_t)mpc_image_get_fn(in);
+      p->data.check_with.f = (mpc_check_with_t)mpc_image_get_fn(in);
+      p->data.check_with.e = mpc_image_get_string(in);
+      p->data.check_with.d = NULL;
+      break;
+
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpc_image_get_parser(in, ps, n);
+      p->data.expect.m = mpc_image_get_string(in);
+      if (p->data.expect.m == NULL) { in->failed = 1; }
+      break;
+
+    case MPC_TYPE_PREDICT: p->data.predict.x = mpc_image_get_parser(in, ps, n); break;
+
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      p->data.not.x = mpc_image_get_parser(in, ps, n);
+      p->data.not.dx = (mpc_dtor_t)mpc_image_get_fn(in);
+      p->data.not.lf = (mpc_ctor_t)mpc_image_get_fn(in);
+      break;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.n = (int)mpc_image_get_int(in);
+      p->data.repeat.f = (mpc_fold_t)mpc_image_get_fn(in);
+      p->data.repeat.x = mpc_image_get_parser(in, ps, n);
+      p->data.repeat.dx = (mpc_dtor_t)mpc_image_get_fn(in);
+      break;
+
+    case MPC_TYPE_SEPBY1:
+      p->data.sepby1.n = (int)mpc_image_get_int(in);
+      p->data.sepby1.f = (mpc_fold_t)mpc_image_get_fn(in);
+      p->data.sepby1.x = mpc_image_get_parser(in, ps, n);
+      p->data.sepby1.sep = mpc_image_get_parser(in, ps, n);
+      break;
+
+    case MPC_TYPE_OR:
+      p->data.or.n = mpc_image_get_count(in);
+      p->data.or.xs = malloc(sizeof(mpc_parser_t*) * (p->data.or.n + 1));
+      p->data.or.dispatch = NULL;
+      for (j = 0; j < p->data.or.n; j++) { p->data.or.xs[j] = mpc_image_get_parser(in, ps, n); }
+      break;
+
+    case MPC_TYPE_AND:
+      p->data.and.n = mpc_image_get_count(in);
+      p->data.and.f = (mpc_fold_t)mpc_image_get_fn(in);
+      p->data.and.xs = malloc(sizeof(mpc_parser_t*) * (p->data.and.n + 1));
+      p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (p->data.and.n + 1));
+      for (j = 0; j < p->data.and.n; j++) { p->data.and.xs[j] = mpc_image_get_parser(in, ps, n); }
+      for (j = 0; j < p->data.and.n-1; j++) { p->data.and.dxs[j] = (mpc_dtor_t)mpc_image_get_fn(in); }
+      break;
+
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+      break;
+
+    default: in->failed = 1; break;
+  }
+
+}
+
+/* Frees what a parser loaded from an image holds itself, but not the parsers it runs */
+static void mpc_image_discard(mpc_parser_t *p) {
+
+  switch (p->type) {
+    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING: free(p->data.string.x); break;
+    case MPC_TYPE_DFA: free(p->data.dfa.next); free(p->data.dfa.accept); break;
+    case MPC_TYPE_CHECK: free(p->data.check.e); break;
+    case MPC_TYPE_CHECK_WITH: free(p->data.check_with.e); break;
+    case MPC_TYPE_EXPECT: free(p->data.expect.m); break;
+    case MPC_TYPE_OR: free(p->data.or.xs); break;
+    case MPC_TYPE_AND: free(p->data.and.xs); free(p->data.and.dxs); break;
+    default: break;
+  }
+
+  free(p->name);
+  free(p);
+}
+
+static void mpc_optimise_dispatch(mpc_parser_t *p);
+
+/*
+** Each parser is read into a new one. Those named are only defined from
+** theirs, and given to the parsers which run them, as the ones passed in by
+** that name, once the whole image has been read.
+*/
+
+static int mpc_image_load(int flags, const char *language, const unsigned char *image, size_t length, mpca_grammar_st_t *st) {
+
+  int j, n;
+  char *name;
+  mpc_parser_t **ps, **defs;
+  mpc_image_in_t in = { NULL, 0, 0, 0, 0, NULL };
+
+  in.data = image;
+  in.length = image ? length : 0;
+
+  if (mpc_image_get(&in) != 'm' || mpc_image_get(&in) != 'p' || mpc_image_get(&in) != 'c'
+  ||  mpc_image_get(&in) != MPC_IMAGE_VERSION
+  ||  mpc_image_get_int(&in) != flags) { return 0; }
+
+  name = mpc_image_get_string(&in);
+  if (name == NULL || strcmp(name, language) != 0) { free(name); return 0; }
+  free(name);
+
+  n = mpc_image_get_count(&in);
+  if (in.failed || n == 0) { return 0; }
+
+  ps = calloc(n, sizeof(mpc_parser_t*));
+  defs = calloc(n, sizeof(mpc_parser_t*));
+  in.owned = calloc(n, 1);
+
+  for (j = 0; j < n && !in.failed; j++) {
+    defs[j] = mpc_undefined();
+    name = mpc_image_get_string(&in);
+    if (name == NULL) { ps[j] = defs[j]; continue; }
+    ps[j] = mpca_grammar_find_parser(name, st);
+    free(name);
+    if (!ps[j]->retained) { mpc_delete(ps[j]); in.failed = 1; }
+  }
+
+  for (j = 0; j < n && !in.failed; j++) {
+    in.parser = j;
+    defs[j]->type = (char)mpc_image_get(&in);
+    defs[j]->flat = (char)mpc_image_get(&in);
+    defs[j]->id = (int)mpc_image_get_int(&in);
+    mpc_image_get_data(&in, defs[j], ps, n);
+  }
+
+  for (j = 0; j < n && !in.failed; j++) {
+    if (!ps[j]->retained && !in.owned[j]) { in.failed = 1; }
+  }
+
+  if (in.failed) {
+    for (j = 0; j < n; j++) {
+      if (defs[j]) { mpc_image_discard(defs[j]); }
+    }
+    free(ps);
+    free(defs);
+    free(in.owned);
+    return 0;
+  }
+
+  for (j = 0; j < n; j++) {
+    if (ps[j] != defs[j]) { mpc_define(ps[j], defs[j]); }
+  }
+
+  /* The characters an `or` can start with are worked out again rather than saved */
+  for (j = 0; j < n; j++) {
+    if (ps[j]->type == MPC_TYPE_OR) { mpc_optimise_dispatch(ps[j]); }
+  }
+
+  free(ps);
+  free(defs);
+  free(in.owned);
+  return 1;
+}
+
+/* Optimises the parsers a grammar names again once all are defined, so each `or` sees what its alternatives start with */
+static void mpca_lang_optimise(mpca_grammar_st_t *st) {
+  int j;
+  for (j = 0; j < st->parsers_num; j++) {
+    if (st->parsers[j] && st->parsers[j]->retained) { mpc_optimise(st->parsers[j]); }
+  }
+}
+
+mpc_err_t *mpca_lang_save(int flags, const char *language, unsigned char **image, size_t *length, ...) {
+
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;
+  va_start(va, length);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  *image = NULL;
+  *length = 0;
+
+  i = mpc_input_new_string("<mpca_lang_save>", language);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+
+  if (err == NULL) {
+    mpca_lang_optimise(&st);
+    *image = mpc_image_save(flags, language, st.parsers, st.parsers_num, length);
+    if (*image == NULL) { err = mpc_err_file("<mpca_lang_save>", "Grammar uses callbacks which cannot be saved!"); }
+  }
+
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_load(int flags, const char *language, const unsigned char *image, size_t length, ...) {
+
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err = NULL;
+
+  va_list va;
+  va_start(va, length);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  if (!mpc_image_load(flags, language, image, length, &st)) {
+    i = mpc_input_new_string("<mpca_lang>", language);
+    err = mpca_lang_st(i, &st);
+    mpc_input_delete(i);
+    if (err == NULL) { mpca_lang_optimise(&st); }
+  }
+
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
+
+  int i, total;
+
+  if (p->retained && !force) { return 0; }
+
+  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+
+  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+
+  if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
+
+  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+
+  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_SEPBY1) {
+    total = 1;
+    total += mpc_nodecount_unretained(p->data.sepby1.x, 0);
+    total += mpc_nodecount_unretained(p->data.sepby1.sep, 0);
+    total += mpc_nodecount_unretained(p->data.sepby1.x, 0);
+    return total;
+  }
+
+  if (p->type == MPC_TYPE_OR) {
+    total = 1;
+    for(i = 0; i < p->data.or.n; i++) {
+      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
+    }
+    return total;
+  }
+
+  if (p->type == MPC_TYPE_AND) {
+    total = 1;
+    for(i = 0; i < p->data.and.n; i++) {
+      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
+    }
+    return total;
+  }
+
+  return 1;
+
+}
+
+void mpc_stats(mpc_parser_t* p) {
+  printf("Stats\n");
+  printf("=====\n");
+  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+}
+
+/*
+** First Sets
+**
+** The characters a parser can start by consuming, and whether it can
+** succeed without consuming any. Whatever cannot be worked out, such as a
+** parser not defined yet or one recursing into itself before consuming
+** anything, is taken to start with any character. An `or` of at most 32
+** alternatives gets a table from each character to the alternatives that
+** can start with it, so "mpc_parse" skips the others. Alternatives that
+** can succeed without consuming are never skipped, and neither is anything
+** at the end of the input, so the grammar parses exactly what it did, and
+** should be optimised once all of its parsers are defined.
+*/
+
+enum {
+  MPC_FIRST_DEPTH = 64
+};
+
+static void mpc_first_add(unsigned char *set, int c) {
+  set[c >> 3] |= (unsigned char)(1 << (c & 7));
+}
+
+static int mpc_first_has(const unsigned char *set, int c) {
+  return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static int mpc_first(mpc_parser_t *p, unsigned char *set, mpc_parser_t **stack, int depth) {
+
+  int j, k;
+  const char *x;
+
+  if (depth == MPC_FIRST_DEPTH) { memset(set, 0xFF, 32); return 1; }
+
+  for (j = 0; j < depth; j++) {
+    if (stack[j] == p) { memset(set, 0xFF, 32); return 1; }
+  }
+
+  stack[depth] = p;
+
+  switch (p->type) {
+
+    case MPC_TYPE_SINGLE: mpc_first_add(set, (unsigned char)p->data.single.x); return 0;
+
+    case MPC_TYPE_RANGE:
+      for (j = (unsigned char)p->data.range.x; j <= (unsigned char)p->data.range.y; j++) { mpc_first_add(set, j); }
+      return 0;
+
+    case MPC_TYPE_ONEOF:
+      for (x = p->data.string.x; *x; x++) { mpc_first_add(set, (unsigned char)*x); }
+      return 0;
+
+    case MPC_TYPE_NONEOF:
+      for (j = 1; j < 256; j++) { if (!strchr(p->data.string.x, j)) { mpc_first_add(set, j); } }
+      return 0;
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SATISFY:
+      for (j = 1; j < 256; j++) { mpc_first_add(set, j); }
+      return 0;
+
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 1; }
+      mpc_first_add(set, (unsigned char)p->data.string.x[0]);
+      return 0;
+
+    case MPC_TYPE_DFA:
+      for (j = 0; j < 256; j++) { if (p->data.dfa.next[j] >= 0) { mpc_first_add(set, j); } }
+      return p->data.dfa.accept[0];
+
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_NOT:
+      return 1;
+
+    case MPC_TYPE_EXPECT:     return mpc_first(p->data.expect.x, set, stack, depth+1);
+    case MPC_TYPE_APPLY:      return mpc_first(p->data.apply.x, set, stack, depth+1);
+    case MPC_TYPE_APPLY_TO:   return mpc_first(p->data.apply_to.x, set, stack, depth+1);
+    case MPC_TYPE_CHECK:      return mpc_first(p->data.check.x, set, stack, depth+1);
+    case MPC_TYPE_CHECK_WITH: return mpc_first(p->data.check_with.x, set, stack, depth+1);
+    case MPC_TYPE_PREDICT:    return mpc_first(p->data.predict.x, set, stack, depth+1);
+
+    case MPC_TYPE_MAYBE: mpc_first(p->data.not.x, set, stack, depth+1); return 1;
+    case MPC_TYPE_MANY:  mpc_first(p->data.repeat.x, set, stack, depth+1); return 1;
+    case MPC_TYPE_MANY1: return mpc_first(p->data.repeat.x, set, stack, depth+1);
+
+    case MPC_TYPE_COUNT:
+      k = mpc_first(p->data.repeat.x, set, stack, depth+1);
+      return k || p->data.repeat.n == 0;
+
+    case MPC_TYPE_SEPBY1:
+      if (!mpc_first(p->data.sepby1.x, set, stack, depth+1)) { return 0; }
+      mpc_first(p->data.sepby1.sep, set, stack, depth+1);
+      return 1;
+
+    case MPC_TYPE_OR:
+      for (j = 0, k = 0; j < p->data.or.n; j++) {
+        k |= mpc_first(p->data.or.xs[j], set, stack, depth+1);
+      }
+      return k || p->data.or.n == 0;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_first(p->data.and.xs[j], set, stack, depth+1)) { return 0; }
+      }
+      return 1;
+
+    default:
+      memset(set, 0xFF, 32);
+      return 1;
+  }
+
+}
+
+static void mpc_optimise_dispatch(mpc_parser_t *p) {
+
+  int j, c;
+  uint32_t all;
+  unsigned char set[32];
+  mpc_parser_t *stack[MPC_FIRST_DEPTH];
+
+  free(p->data.or.dispatch);
+  p->data.or.dispatch = NULL;
+
+  if (p->data.or.n < 2 || p->data.or.n > 32) { return; }
+
+  p->data.or.dispatch = calloc(256, sizeof(uint32_t));
+  all = p->data.or.n == 32 ? 0xFFFFFFFF : ((uint32_t)1 << p->data.or.n) - 1;
+
+  for (j = 0; j < p->data.or.n; j++) {
+    memset(set, 0, sizeof(set));
+    stack[0] = p;
+    if (mpc_first(p->data.or.xs[j], set, stack, 1)) { memset(set, 0xFF, sizeof(set)); }
+    for (c = 1; c < 256; c++) {
+      if (mpc_first_has(set, c)) { p->data.or.dispatch[c] |= (uint32_t)1 << j; }
+    }
+  }
+
+  /* Characters every alternative can start with are left at 0 like the end of input, to try all as usual */
+  for (c = 1; c < 256; c++) {
+    if (p->data.or.dispatch[c] == all) { p->data.or.dispatch[c] = 0; }
+  }
+
+}
+
+/* Whether a parser can be run without a frame of the parse stack, see mpc_parse_flat */
+
+static int mpc_optimise_flat_child(mpc_parser_t *p) {
+  return !p->retained && p->flat;
+}
+
+static int mpc_optimise_flat(mpc_parser_t *p) {
+
+  int j;
+
+  switch (p->type) {
+
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_FAIL:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+    case MPC_TYPE_STRING:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+    case MPC_TYPE_DFA:
+      return 1;
+
+    case MPC_TYPE_APPLY:    return mpc_optimise_flat_child(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO: return mpc_optimise_flat_child(p->data.apply_to.x);
+    case MPC_TYPE_EXPECT:   return mpc_optimise_flat_child(p->data.expect.x);
+    case MPC_TYPE_MANY:     return mpc_optimise_flat_child(p->data.repeat.x);
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_optimise_flat_child(p->data.and.xs[j])) { return 0; }
+      }
+      return 1;
+
+    default: return 0;
+  }
+
+}
+
+static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+
+  int i, n, m;
+  mpc_parser_t *t;
+
+  if (p->retained && !force) { return; }
+
+  /* Optimise Subexpressions */
+
+  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
@@ -3998,7 +6090,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.dispatch); free(t->name); free(t);
       continue;
     }
 
@@ -4012,7 +6104,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.dispatch); free(t->name); free(t);
       continue;
     }
 
@@ -4115,10 +6207,15 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
 
-    return;
+    break;
 
   }
 
+  /* Dispatch `or` on the next character */
+  if (p->type == MPC_TYPE_OR) { mpc_optimise_dispatch(p); }
+
+  p->flat = mpc_optimise_flat(p);
+
 }
 
 void mpc_optimise(mpc_parser_t *p) {
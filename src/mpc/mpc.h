@@ -65,9 +65,11 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+/* Strings are parsed in place, not copied, and "mpc_nparse" needs no null terminator, so mapped files can be parsed */
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
+/* Pipes are read in blocks, anything read past the end of the parse is consumed with it and not returned to the pipe */
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
@@ -94,6 +96,9 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a);
 mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a);
 mpc_parser_t *mpc_undefine(mpc_parser_t *p);
 
+/* AST nodes tagged with a named parser's name in a grammar also get its id, the innermost rule's winning */
+mpc_parser_t *mpc_tag_id(mpc_parser_t *p, int id);
+
 void mpc_delete(mpc_parser_t *p);
 void mpc_cleanup(int n, ...);
 
@@ -284,6 +289,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode);
 
 typedef struct mpc_ast_t {
   char *tag;
+  int tag_id;
   char *contents;
   mpc_state_t state;
   int children_num;
@@ -295,11 +301,47 @@ mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
+mpc_ast_t *mpc_ast_add_tag_id(mpc_ast_t *a, const char *t, int id);
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 
 void mpc_ast_delete(mpc_ast_t *a);
+
+/*
+** Arenas hold whole trees parsed by "mpc_nparse_arena" in a few large blocks,
+** with tags pointing at the grammar's rule names, so they must not outlive the
+** grammar. Such trees are freed all at once with their arena, never with
+** "mpc_ast_delete", and must not be modified by the other "mpc_ast" functions.
+*/
+
+struct mpc_ast_arena_t;
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
+mpc_ast_arena_t *mpc_ast_arena_new(void);
+void mpc_ast_arena_delete(mpc_ast_arena_t *a);
+
+int mpc_nparse_arena(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r);
+
+/*
+** Packrat parsing remembers what every named parser of an "mpca" grammar
+** did at each position it was tried, so it is never parsed there twice.
+** Parses into the arena keep up to "entries" of these (0 turns it off),
+** a newer one replacing an older one hashed to the same place, so memory
+** stays bounded and parsing is only linear if nothing gets replaced.
+*/
+
+typedef struct {
+  long lookups;
+  long hits;
+  long stores;
+  long evictions;
+} mpc_packrat_stats_t;
+
+void mpc_ast_arena_packrat(mpc_ast_arena_t *a, int entries);
+mpc_packrat_stats_t mpc_ast_arena_packrat_stats(mpc_ast_arena_t *a);
+void mpc_ast_arena_packrat_print(mpc_ast_arena_t *a);
+
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
 
@@ -365,6 +407,17 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_pipe(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
+/*
+** Grammar Images
+**
+** Saves a grammar once it is built, so that loading it again skips parsing
+** the language. Loading an image saved from other flags or language, or by
+** another version of mpc, builds the grammar with "mpca_lang" instead.
+*/
+
+mpc_err_t *mpca_lang_save(int flags, const char *language, unsigned char **image, size_t *length, ...);
+mpc_err_t *mpca_lang_load(int flags, const char *language, const unsigned char *image, size_t length, ...);
+
 /*
 ** Misc
 */
@@ -0,0 +1,495 @@
+#include <stdlib.h>
+#include <threads.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "pool.h"
+
+#define DEQUE_INITIAL_SIZE 64
+
+// circular array of a deque, old arrays are retired rather than freed when a deque grows
+// because thieves may still be reading from them
+typedef struct lispdequebuffer
+{
+    int64_t size;
+    struct lispdequebuffer* retired;
+    _Atomic(lisptask*) tasks[];
+} lispdequebuffer;
+
+// Chase-Lev work-stealing deque, the owning worker pushes and takes at the bottom
+// while other workers steal from the top
+typedef struct lispdeque
+{
+    _Atomic(int64_t) top;
+    _Atomic(int64_t) bottom;
+    _Atomic(lispdequebuffer*) buffer;
+} lispdeque;
+
+typedef struct lispworker
+{
+    lisppool* pool;
+    lispdeque deque;
+    thrd_t thread;
+    uint64_t seed;
+} lispworker;
+
+struct lisppool
+{
+    // references held by whoever may still hand the pool work, once the last one is deleted
+    // the workers stop and the last of them to exit frees the pool
+    _Atomic(int64_t) refs;
+    atomic_int alive;
+
+    int worker_count;
+    lispworker* workers;
+
+    atomic_int running;
+
+    // tasks handed in by threads outside the pool, and the condition they wait on
+    mtx_t lock;
+    cnd_t finished;
+    lisptask* injected;
+    lisptask* injected_last;
+    atomic_int injected_count;
+
+    // external tasks that have not finished yet
+    atomic_int pending;
+
+    // idle workers sleep until the epoch moves on, which it does whenever work is added
+    cnd_t wake;
+    atomic_uint_fast64_t epoch;
+    atomic_int sleepers;
+};
+
+static _Thread_local lispworker* current_worker = NULL;
+
+static lispdequebuffer* lispdequebuffer_new(int64_t size, lispdequebuffer* retired)
+{
+    lispdequebuffer* buffer = malloc(sizeof(lispdequebuffer) + sizeof(_Atomic(lisptask*)) * size);
+    buffer->size = size;
+    buffer->retired = retired;
+
+    return buffer;
+}
+
+static void lispdeque_init(lispdeque* d)
+{
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->buffer, lispdequebuffer_new(DEQUE_INITIAL_SIZE, NULL));
+}
+
+static void lispdeque_destroy(lispdeque* d)
+{
+    lispdequebuffer* buffer = atomic_load(&d->buffer);
+
+    while (buffer)
+    {
+        lispdequebuffer* retired = buffer->retired;
+        free(buffer);
+        buffer = retired;
+    }
+}
+
+static void lispdeque_push(lispdeque* d, lisptask* task)
+{
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    lispdequebuffer* a = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+
+    // full, so copy the live tasks into an array twice the size
+    if (b - t > a->size - 1)
+    {
+        lispdequebuffer* grown = lispdequebuffer_new(a->size * 2, a);
+
+        for (int64_t i = t; i < b; i++)
+        atomic_store_explicit(&grown->tasks[i & (grown->size - 1)],
+        atomic_load_explicit(&a->tasks[i & (a->size - 1)], memory_order_relaxed), memory_order_relaxed);
+
+        atomic_store_explicit(&d->buffer, grown, memory_order_release);
+        a = grown;
+    }
+
+    atomic_store_explicit(&a->tasks[b & (a->size - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+static lisptask* lispdeque_take(lispdeque* d)
+{
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    lispdequebuffer* a = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    lisptask* task = NULL;
+
+    if (t <= b)
+    {
+        task = atomic_load_explicit(&a->tasks[b & (a->size - 1)], memory_order_relaxed);
+
+        // the last task left, race any thieves for it
+        if (t == b)
+        {
+            if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) task = NULL;
+
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+    }
+
+    else atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+
+    return task;
+}
+
+static lisptask* lispdeque_steal(lispdeque* d)
+{
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (t >= b) return NULL;
+
+    lispdequebuffer* a = atomic_load_explicit(&d->buffer, memory_order_acquire);
+    lisptask* task = atomic_load_explicit(&a->tasks[t & (a->size - 1)], memory_order_relaxed);
+
+    // lost the race to the owner or another thief
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+    memory_order_seq_cst, memory_order_relaxed)) return NULL;
+
+    return task;
+}
+
+static void lisppool_notify(lisppool* pool)
+{
+    atomic_fetch_add(&pool->epoch, 1);
+
+    if (atomic_load(&pool->sleepers))
+    {
+        mtx_lock(&pool->lock);
+        cnd_broadcast(&pool->wake);
+        mtx_unlock(&pool->lock);
+    }
+}
+
+static void lisppool_execute(lisppool* pool, lisptask* task)
+{
+    task->run(task);
+
+    // threads outside the pool wait on a condition variable rather than spinning on the flag,
+    // the task may be freed as soon as it is marked done so it is not touched afterwards
+    if (task->external)
+    {
+        mtx_lock(&pool->lock);
+        atomic_store_explicit(&task->done, 1, memory_order_release);
+        atomic_fetch_sub(&pool->pending, 1);
+        cnd_broadcast(&pool->finished);
+        mtx_unlock(&pool->lock);
+    }
+
+    else atomic_store_explicit(&task->done, 1, memory_order_release);
+}
+
+static lisptask* lisppool_find(lispworker* w, int injected)
+{
+    lisppool* pool = w->pool;
+
+    lisptask* task = lispdeque_take(&w->deque);
+    if (task) return task;
+
+    // xorshift to pick where to start stealing, so thieves spread out over the victims
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+
+    int start = (int)(w->seed % pool->worker_count);
+
+    for (int i = 0; i < pool->worker_count; i++)
+    {
+        lispworker* victim = &pool->workers[(start + i) % pool->worker_count];
+        if (victim == w) continue;
+
+        task = lispdeque_steal(&victim->deque);
+        if (task) return task;
+    }
+
+    if (injected && atomic_load(&pool->injected_count))
+    {
+        mtx_lock(&pool->lock);
+
+        task = pool->injected;
+
+        if (task)
+        {
+            pool->injected = task->next;
+            atomic_fetch_sub(&pool->injected_count, 1);
+        }
+
+        mtx_unlock(&pool->lock);
+    }
+
+    return task;
+}
+
+// frees a pool whose workers have all exited
+static void lisppool_free(lisppool* pool)
+{
+    for (int i = 0; i < pool->worker_count; i++) lispdeque_destroy(&pool->workers[i].deque);
+
+    cnd_destroy(&pool->wake);
+    cnd_destroy(&pool->finished);
+    mtx_destroy(&pool->lock);
+
+    free(pool->workers);
+    free(pool);
+}
+
+static int lisppool_worker_main(void* arg)
+{
+    lispworker* w = arg;
+    lisppool* pool = w->pool;
+
+    current_worker = w;
+
+    while (atomic_load(&pool->running))
+    {
+        uint_fast64_t epoch = atomic_load(&pool->epoch);
+
+        lisptask* task = lisppool_find(w, 1);
+
+        if (task)
+        {
+            lisppool_execute(pool, task);
+            continue;
+        }
+
+        // nothing to do, sleep unless work was added since we started looking
+        mtx_lock(&pool->lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+
+        if (atomic_load(&pool->epoch) == epoch && atomic_load(&pool->running))
+        cnd_wait(&pool->wake, &pool->lock);
+
+        atomic_fetch_sub(&pool->sleepers, 1);
+        mtx_unlock(&pool->lock);
+    }
+
+    // no one holds the pool any more, so nothing else can be touching it once the other workers are gone
+    if (atomic_fetch_sub(&pool->alive, 1) == 1) lisppool_free(pool);
+
+    return 0;
+}
+
+lisppool* lisppool_new(int worker_count)
+{
+    if (worker_count < 1) worker_count = 1;
+
+    lisppool* pool = malloc(sizeof(lisppool));
+    atomic_init(&pool->refs, 1);
+    atomic_init(&pool->alive, worker_count);
+    pool->worker_count = worker_count;
+    pool->workers = malloc(sizeof(lispworker) * worker_count);
+
+    atomic_init(&pool->running, 1);
+
+    mtx_init(&pool->lock, mtx_plain);
+    cnd_init(&pool->finished);
+    cnd_init(&pool->wake);
+
+    pool->injected = NULL;
+    pool->injected_last = NULL;
+    atomic_init(&pool->injected_count, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->epoch, 0);
+    atomic_init(&pool->sleepers, 0);
+
+    // deques must all exist before any worker starts stealing
+    for (int i = 0; i < worker_count; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].seed = 0x9E3779B97F4A7C15ull * (i + 1);
+        lispdeque_init(&pool->workers[i].deque);
+    }
+
+    // workers are never joined, the pool is freed by the last of them to exit
+    for (int i = 0; i < worker_count; i++)
+    {
+        thrd_create(&pool->workers[i].thread, lisppool_worker_main, &pool->workers[i]);
+        thrd_detach(pool->workers[i].thread);
+    }
+
+    return pool;
+}
+
+void lisppool_delete(lisppool* pool)
+{
+    if (atomic_fetch_sub_explicit(&pool->refs, 1, memory_order_acq_rel) != 1) return;
+
+    // every holder waited for the tasks it handed in, so the workers only have to be woken to exit,
+    // which may include the one deleting the last reference from inside a task
+    mtx_lock(&pool->lock);
+    atomic_store(&pool->running, 0);
+    cnd_broadcast(&pool->wake);
+    mtx_unlock(&pool->lock);
+}
+
+static lisppool* shared_pool = NULL;
+static int shared_worker_count = 0;
+static mtx_t shared_lock;
+static once_flag shared_once = ONCE_FLAG_INIT;
+
+static void lisppool_shared_init()
+{
+    mtx_init(&shared_lock, mtx_plain);
+}
+
+static int lisppool_default_worker_count()
+{
+    char* workers = getenv("LISPY_WORKERS");
+    if (workers && atoi(workers) > 0) return atoi(workers);
+
+#if defined(_SC_NPROCESSORS_ONLN)
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors > 0) return (int)processors;
+#endif
+
+    return 1;
+}
+
+lisppool* lisppool_shared()
+{
+    call_once(&shared_once, lisppool_shared_init);
+
+    mtx_lock(&shared_lock);
+
+    if (!shared_pool)
+    {
+        if (!shared_worker_count) shared_worker_count = lisppool_default_worker_count();
+        shared_pool = lisppool_new(shared_worker_count);
+    }
+
+    lisppool* pool = shared_pool;
+    atomic_fetch_add_explicit(&pool->refs, 1, memory_order_relaxed);
+    mtx_unlock(&shared_lock);
+
+    return pool;
+}
+
+int lisppool_configure(int worker_count)
+{
+    call_once(&shared_once, lisppool_shared_init);
+
+    mtx_lock(&shared_lock);
+
+    if (worker_count < 1) worker_count = lisppool_default_worker_count();
+
+    // the pool is rebuilt lazily with the new size, the old one keeps running
+    // the tasks already handed to it until whoever handed them in lets go of it
+    if (shared_pool && shared_pool->worker_count != worker_count)
+    {
+        lisppool_delete(shared_pool);
+        shared_pool = NULL;
+    }
+
+    shared_worker_count = worker_count;
+    mtx_unlock(&shared_lock);
+
+    return worker_count;
+}
+
+int lisppool_worker_count(lisppool* pool)
+{
+    return pool->worker_count;
+}
+
+void lisppool_run(lisppool* pool, lisptask* task)
+{
+    if (current_worker && current_worker->pool == pool)
+    {
+        task->run(task);
+        return;
+    }
+
+    lisppool_submit(pool, task);
+    lisppool_wait(pool, task);
+}
+
+void lisppool_submit(lisppool* pool, lisptask* task)
+{
+    atomic_init(&task->done, 0);
+    task->external = 1;
+    task->next = NULL;
+
+    atomic_fetch_add(&pool->pending, 1);
+
+    // even a worker's submissions are injected, the deques only ever hold forked tasks,
+    // so joining a fork never runs a whole external task, such as a future, while it waits
+    mtx_lock(&pool->lock);
+
+    if (pool->injected) pool->injected_last->next = task;
+    else pool->injected = task;
+
+    pool->injected_last = task;
+    atomic_fetch_add(&pool->injected_count, 1);
+
+    mtx_unlock(&pool->lock);
+
+    lisppool_notify(pool);
+}
+
+void lisppool_wait(lisppool* pool, lisptask* task)
+{
+    lispworker* w = current_worker;
+
+    // a worker cannot block, the task may be behind it in the queue,
+    // so it runs anything it can find, including external tasks, until the task is done
+    if (w && w->pool == pool)
+    {
+        while (!atomic_load_explicit(&task->done, memory_order_acquire))
+        {
+            lisptask* other = lisppool_find(w, 1);
+
+            if (other) lisppool_execute(pool, other);
+            else thrd_yield();
+        }
+    }
+
+    // "lisppool_execute" sets done for external tasks while holding the lock, so returning here
+    // means it is finished with the task
+    mtx_lock(&pool->lock);
+    while (!atomic_load_explicit(&task->done, memory_order_acquire)) cnd_wait(&pool->finished, &pool->lock);
+    mtx_unlock(&pool->lock);
+}
+
+void lisppool_fork(lisptask* task)
+{
+    atomic_init(&task->done, 0);
+    task->external = 0;
+    task->next = NULL;
+
+    lispdeque_push(&current_worker->deque, task);
+    lisppool_notify(current_worker->pool);
+}
+
+void lisppool_join(lisptask* task)
+{
+    lispworker* w = current_worker;
+
+    // help with other forked work while waiting, the deques hold nothing else and injected tasks are left alone
+    while (!atomic_load_explicit(&task->done, memory_order_acquire))
+    {
+        lisptask* other = lisppool_find(w, 0);
+
+        if (other) lisppool_execute(w->pool, other);
+        else thrd_yield();
+    }
+}
+
+int lisppool_in_worker()
+{
+    return current_worker != NULL;
+}
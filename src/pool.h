@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// default number of elements below which parallel builtins stop splitting work
+#ifndef PARALLEL_CUTOFF
+#define PARALLEL_CUTOFF 64
+#endif
+
+struct lisptask;
+struct lisppool;
+typedef struct lisptask lisptask;
+typedef struct lisppool lisppool;
+
+// a unit of work for the pool, embedded at the start of a larger struct holding its arguments,
+// the memory is owned by whoever forks or runs the task and must outlive the join
+typedef struct lisptask
+{
+    void (*run)(lisptask* task);
+    atomic_int done;
+
+    // set for tasks that may be waited on from outside the pool, these are counted until they finish
+    int external;
+    lisptask* next;
+} lisptask;
+
+// functions to construct and destruct a work-stealing pool with the given number of worker threads,
+// a pool is reference counted and deleting the last reference stops its workers, which free it as they exit,
+// so it must only be deleted once the tasks handed to it through that reference have been waited for
+lisppool* lisppool_new(int worker_count);
+void lisppool_delete(lisppool* pool);
+
+// a reference to the pool shared by the whole process, created on first use with "lisppool_configure"'s
+// worker count, which defaults to the LISPY_WORKERS environment variable or the number of processors,
+// configuring another count replaces the shared pool without waiting for the tasks running on the old one
+lisppool* lisppool_shared();
+int lisppool_configure(int worker_count);
+int lisppool_worker_count(lisppool* pool);
+
+// runs a task on the pool and waits for it, from any thread,
+// tasks run by a worker of the pool already are run inline
+void lisppool_run(lisppool* pool, lisptask* task);
+
+// hands a task to the pool without waiting for it, from any thread, it is queued apart from forked tasks,
+// "lisppool_wait" waits for it, and must have returned before the task's memory is freed
+void lisppool_submit(lisppool* pool, lisptask* task);
+void lisppool_wait(lisppool* pool, lisptask* task);
+
+// fork a task onto the current worker's deque, and join it again,
+// running other forked tasks while waiting, these may only be called from inside a task
+void lisppool_fork(lisptask* task);
+void lisppool_join(lisptask* task);
+
+// whether the calling thread is one of a pool's workers
+int lisppool_in_worker();
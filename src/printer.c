@@ -1,31 +1,106 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
 
 #include "definitions.h"
 
 #include "printer.h"
 
-void lispvalue_print(lispvalue* lv)
+// growable string the printer writes into
+typedef struct lispbuffer
+{
+    char* data;
+    size_t length;
+    size_t capacity;
+} lispbuffer;
+
+static void lispbuffer_printf(lispbuffer* b, char* format, ...)
+{
+    va_list va;
+
+    va_start(va, format);
+    int n = vsnprintf(NULL, 0, format, va);
+    va_end(va);
+
+    if (n < 0) return;
+
+    // grow geometrically so printing long lists stays linear
+    if (b->length + n + 1 > b->capacity)
+    {
+        while (b->length + n + 1 > b->capacity) b->capacity *= 2;
+        b->data = realloc(b->data, b->capacity);
+    }
+
+    va_start(va, format);
+    vsnprintf(b->data + b->length, n + 1, format, va);
+    va_end(va);
+
+    b->length += n;
+}
+
+static void lispvalue_write(lispbuffer* b, lispvalue* lv);
+
+static void lispvalue_write_expression(lispbuffer* b, lispvalue* lv, char open, char close)
+{
+    lispbuffer_printf(b, "%c", open);
+
+    for (int i = 0; i < lv->cell_count; i++)
+    {
+        // recursively write each nested expression
+        lispvalue_write(b, lv->cells[i]);
+
+        // keep adding spaces between each nested expression until loop ends
+        if (i != (lv->cell_count - 1)) lispbuffer_printf(b, " ");
+    }
+
+    lispbuffer_printf(b, "%c", close);
+}
+
+static void lispvalue_write(lispbuffer* b, lispvalue* lv)
 {
     switch (lv->type)
     {
-        case LISPVALUE_ERROR:       printf("error: %s", lv->error); break;
-        case LISPVALUE_NUMBER:      printf("%lli", lv->number); break;
-        case LISPVALUE_SYMBOL:      printf("%s", lv->symbol); break;
-        case LISPVALUE_SEXPRESSION: lispvalue_print_expression(lv, '(', ')'); break;
-        case LISPVALUE_QEXPRESSION: lispvalue_print_expression(lv, '{', '}'); break;
-        case LISPVALUE_FUNCTION:    
-            if(lv->builtin) printf("<builtin>");
-            
+        case LISPVALUE_ERROR:       lispbuffer_printf(b, "error: %s", lv->error); break;
+        case LISPVALUE_NUMBER:      lispbuffer_printf(b, "%lli", (long long) lv->number); break;
+        case LISPVALUE_SYMBOL:      lispbuffer_printf(b, "%s", lv->symbol); break;
+        case LISPVALUE_SEXPRESSION: lispvalue_write_expression(b, lv, '(', ')'); break;
+        case LISPVALUE_QEXPRESSION: lispvalue_write_expression(b, lv, '{', '}'); break;
+        case LISPVALUE_FUNCTION:
+            if (!lv->code) lispbuffer_printf(b, "<builtin>");
+
             else
             {
-                printf("(\\ "); lispvalue_print(lv->formals);
-                putchar(' '); lispvalue_print(lv->body); putchar(')');
+                lispbuffer_printf(b, "(\\ "); lispvalue_write(b, lv->code->formals);
+                lispbuffer_printf(b, " "); lispvalue_write(b, lv->code->body); lispbuffer_printf(b, ")");
             }
-             
+
             break;
+
+        case LISPVALUE_CHANNEL:     lispbuffer_printf(b, "<channel>"); break;
+        case LISPVALUE_ISOLATE:     lispbuffer_printf(b, "<isolate>"); break;
+        case LISPVALUE_FUTURE:      lispbuffer_printf(b, "<future>"); break;
+        case LISPVALUE_GENERATOR:   lispbuffer_printf(b, "<generator>"); break;
+        case LISPVALUE_PROMISE:     lispbuffer_printf(b, "<promise>"); break;
     }
 }
 
+char* lispvalue_to_string(lispvalue* lv)
+{
+    lispbuffer b = { malloc(64), 0, 64 };
+    b.data[0] = '\0';
+
+    lispvalue_write(&b, lv);
+    return b.data;
+}
+
+void lispvalue_print(lispvalue* lv)
+{
+    char* s = lispvalue_to_string(lv);
+    fputs(s, stdout);
+    free(s);
+}
+
 void lispvalue_println(lispvalue* lv)
 {
     lispvalue_print(lv); putchar('\n');
@@ -33,17 +108,10 @@ void lispvalue_println(lispvalue* lv)
 
 void lispvalue_print_expression(lispvalue* lv, char open, char close)
 {
-    putchar(open);
-
-    // print each nested expression
-    for (int i = 0; i < lv->cell_count; i++)
-    {
-        // recursively print each nested expression
-        lispvalue_print(lv->cells[i]);
+    lispbuffer b = { malloc(64), 0, 64 };
+    b.data[0] = '\0';
 
-        // keep adding spaces between each nested expression until loop ends
-        if (i != (lv->cell_count - 1)) putchar(' ');
-    }
-
-    putchar(close);
-}
\ No newline at end of file
+    lispvalue_write_expression(&b, lv, open, close);
+    fputs(b.data, stdout);
+    free(b.data);
+}
@@ -5,4 +5,7 @@
 // functions to pretty print parsed tree
 void lispvalue_print(lispvalue* lv);
 void lispvalue_println(lispvalue* lv);
-void lispvalue_print_expression(lispvalue* lv, char open, char close);
\ No newline at end of file
+void lispvalue_print_expression(lispvalue* lv, char open, char close);
+
+// like "lispvalue_print" but returns the printed form as a string the caller frees
+char* lispvalue_to_string(lispvalue* lv);
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+
+#include "constdest.h"
+#include "evaluator.h"
+#include "vm.h"
+
+#include "promise.h"
+
+// its address identifies the thread forcing a promise, it is unique among running threads and never NULL
+static _Thread_local char lisppromise_thread;
+
+lisppromise* lisppromise_new(lispenv* le, lispthunk thunk, lispvalue* arguments)
+{
+    lisppromise* p = malloc(sizeof(lisppromise));
+    atomic_init(&p->refs, 1);
+    atomic_init(&p->state, PROMISE_PENDING);
+    atomic_init(&p->owner, NULL);
+
+    p->thunk = thunk;
+    p->arguments = arguments;
+    p->env = le ? lispenv_capture(le) : NULL;
+    p->value = NULL;
+
+    return p;
+}
+
+static lispvalue* lisppromise_eval(lispvm* vm, lispenv* le, lispvalue* expression)
+{
+    return lispvalue_eval_borrowed(vm, le, expression);
+}
+
+lisppromise* lisppromise_delay(lispenv* le, lispvalue* expression)
+{
+    return lisppromise_new(le, lisppromise_eval, lispvalue_copy(expression));
+}
+
+// frees what computing the value needed
+static void lisppromise_release(lisppromise* p)
+{
+    if (p->arguments) lispvalue_delete(p->arguments);
+    if (p->env) lispenv_delete(p->env);
+
+    p->arguments = NULL;
+    p->env = NULL;
+}
+
+void lisppromise_delete(lisppromise* p)
+{
+    while (p && atomic_fetch_sub_explicit(&p->refs, 1, memory_order_acq_rel) == 1)
+    {
+        lisppromise* rest = NULL;
+        lispvalue* value = p->value;
+
+        // take the promise of the rest of the sequence out of the cell and delete it on the next iteration,
+        // so a long forced sequence does not recurse once per cell
+        if (value && value->type == LISPVALUE_QEXPRESSION && value->cell_count == 2
+        && value->cells[1]->type == LISPVALUE_PROMISE)
+        {
+            rest = value->cells[1]->promise;
+            free(value->cells[1]);
+            value->cell_count = 1;
+        }
+
+        if (value) lispvalue_delete(value);
+        lisppromise_release(p);
+        free(p);
+
+        p = rest;
+    }
+}
+
+// moves a pending promise to the "claimed" state, waiting while another thread transfers it,
+// returns the state it was in, which is only pending if it was claimed
+static int lisppromise_claim(lisppromise* p, int claimed)
+{
+    int state = PROMISE_PENDING;
+
+    while (!atomic_compare_exchange_weak(&p->state, &state, claimed))
+    {
+        if (state == PROMISE_FORCING || state == PROMISE_FORCED) return state;
+
+        // pending again after a spurious failure, or being transferred which does not take long
+        if (state == PROMISE_TRANSFERRING) thrd_yield();
+        state = PROMISE_PENDING;
+    }
+
+    return PROMISE_PENDING;
+}
+
+// waits for a promise another thread is forcing, unless it is this one
+static int lisppromise_wait(lisppromise* p)
+{
+    if (atomic_load(&p->owner) == &lisppromise_thread) return 0;
+
+    // another thread is computing it, which will not take long compared to computing it again
+    while (atomic_load_explicit(&p->state, memory_order_acquire) != PROMISE_FORCED) thrd_yield();
+    return 1;
+}
+
+lispvalue* lisppromise_force(lispvm* vm, lisppromise* p)
+{
+    int state = lisppromise_claim(p, PROMISE_FORCING);
+
+    if (state == PROMISE_PENDING)
+    {
+        atomic_store(&p->owner, &lisppromise_thread);
+
+        // transferred promises are only attached to a global environment once they are forced
+        if (p->env && !p->env->parent) p->env->parent = vm->env;
+
+        lispenv* le = p->env ? p->env : vm->env;
+        lispvalue* value = p->thunk(vm, le, p->arguments);
+
+        p->value = value;
+        lisppromise_release(p);
+        atomic_store_explicit(&p->state, PROMISE_FORCED, memory_order_release);
+    }
+
+    else if (state == PROMISE_FORCING && !lisppromise_wait(p))
+    return lispvalue_error("promise depends on its own value");
+
+    return lispvalue_copy(p->value);
+}
+
+lisppromise* lisppromise_transfer(lisppromise* p)
+{
+    lisppromise* x = malloc(sizeof(lisppromise));
+    atomic_init(&x->refs, 1);
+    atomic_init(&x->owner, NULL);
+
+    x->thunk = p->thunk;
+    x->arguments = NULL;
+    x->env = NULL;
+    x->value = NULL;
+
+    // claimed so that no thread forces it and frees its arguments while they are copied, a promise this
+    // thread is forcing still has them, and one forced on another thread is waited for
+    int state = lisppromise_claim(p, PROMISE_TRANSFERRING);
+    if (state == PROMISE_FORCING && lisppromise_wait(p)) state = PROMISE_FORCED;
+
+    if (state == PROMISE_FORCED)
+    {
+        atomic_init(&x->state, PROMISE_FORCED);
+        x->value = lispvalue_transfer(p->value);
+        return x;
+    }
+
+    atomic_init(&x->state, PROMISE_PENDING);
+    x->arguments = lispvalue_transfer(p->arguments);
+
+    // the bindings are transferred into an environment of their own,
+    // the global one is replaced by the forcing virtual machine's
+    if (p->env) x->env = lispenv_transfer(p->env);
+
+    if (state == PROMISE_PENDING) atomic_store_explicit(&p->state, PROMISE_PENDING, memory_order_release);
+
+    return x;
+}
+
+lispvalue* lispvalue_force(lispvm* vm, lispvalue* lv)
+{
+    if (lv->type == LISPVALUE_PROMISE) return lisppromise_force(vm, lv->promise);
+    return lispvalue_copy(lv);
+}
+
+// a cell of a lazy sequence
+static lispvalue* lisppromise_cell(lispvalue* value, lisppromise* rest)
+{
+    return lispvalue_add(lispvalue_add(lispvalue_qexpression(), value), lispvalue_promise(rest));
+}
+
+// arguments are {next step} or {next step end}
+static lispvalue* lisppromise_range_thunk(lispvm* vm, lispenv* le, lispvalue* arguments)
+{
+    int64_t next = arguments->cells[0]->number;
+    int64_t step = arguments->cells[1]->number;
+
+    if (arguments->cell_count == 3)
+    {
+        int64_t end = arguments->cells[2]->number;
+        if (step > 0 ? next >= end : next <= end) return lispvalue_qexpression();
+    }
+
+    lispvalue* rest = lispvalue_copy(arguments);
+    rest->cells[0]->number = next + step;
+
+    return lisppromise_cell(lispvalue_number(next), lisppromise_new(NULL, lisppromise_range_thunk, rest));
+}
+
+lisppromise* lisppromise_range(int64_t start, int64_t end, int64_t step, int bounded)
+{
+    lispvalue* arguments = lispvalue_qexpression();
+    lispvalue_add(arguments, lispvalue_number(start));
+    lispvalue_add(arguments, lispvalue_number(step));
+    if (bounded) lispvalue_add(arguments, lispvalue_number(end));
+
+    return lisppromise_new(NULL, lisppromise_range_thunk, arguments);
+}
+
+// arguments are {function sequence}
+static lispvalue* lisppromise_map_thunk(lispvm* vm, lispenv* le, lispvalue* arguments)
+{
+    lispvalue* cell = lispvalue_force(vm, arguments->cells[1]);
+    if (cell->type != LISPVALUE_QEXPRESSION || cell->cell_count == 0) return cell;
+
+    if (cell->cell_count != 2)
+    {
+        lispvalue_delete(cell);
+        return lispvalue_error("function \"" LAZY_MAP_STR "\" passed in something that is not a lazy sequence");
+    }
+
+    // the function may take its argument, leaving NULL behind
+    lispvalue* value = lispvalue_pop(cell, 0);
+    lispvalue* x = lispvalue_apply(vm, le, arguments->cells[0], 1, &value);
+    if (value) lispvalue_delete(value);
+
+    if (x->type == LISPVALUE_ERROR)
+    {
+        lispvalue_delete(cell);
+        return x;
+    }
+
+    lispvalue* rest = lispvalue_qexpression();
+    lispvalue_add(rest, lispvalue_copy(arguments->cells[0]));
+    lispvalue_add(rest, lispvalue_take(cell, 0));
+
+    return lisppromise_cell(x, lisppromise_new(le, lisppromise_map_thunk, rest));
+}
+
+lisppromise* lisppromise_map(lispenv* le, lispvalue* function, lispvalue* sequence)
+{
+    lispvalue* arguments = lispvalue_qexpression();
+    lispvalue_add(arguments, lispvalue_copy(function));
+    lispvalue_add(arguments, lispvalue_copy(sequence));
+
+    return lisppromise_new(le, lisppromise_map_thunk, arguments);
+}
+
+lispvalue* lisppromise_take(lispvm* vm, lispvalue* sequence, int64_t count)
+{
+    lispvalue* taken = lispvalue_qexpression();
+    if (count <= 0) return taken;
+
+    lispvalue* cell = lispvalue_force(vm, sequence);
+
+    for (int64_t i = 0; i < count; i++)
+    {
+        if (cell->type == LISPVALUE_ERROR)
+        {
+            lispvalue_delete(taken);
+            return cell;
+        }
+
+        if (cell->type != LISPVALUE_QEXPRESSION || (cell->cell_count != 0 && cell->cell_count != 2))
+        {
+            lispvalue_delete(cell);
+            lispvalue_delete(taken);
+            return lispvalue_error("function \"" TAKE_STR "\" passed in something that is not a lazy sequence");
+        }
+
+        // the sequence ended early
+        if (cell->cell_count == 0) break;
+
+        lispvalue_add(taken, lispvalue_pop(cell, 0));
+
+        lispvalue* rest = cell->cells[0];
+        lispvalue* next = i + 1 < count ? lispvalue_force(vm, rest) : NULL;
+        lispvalue_delete(cell);
+
+        if (!next) return taken;
+        cell = next;
+    }
+
+    lispvalue_delete(cell);
+    return taken;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "definitions.h"
+
+// a pending promise is claimed by moving it to "forcing" or "transferring", so that no thread reads
+// what it is computed from while the one forcing it frees that
+enum PROMISE_STATE
+{
+    PROMISE_PENDING = 0,
+    PROMISE_FORCING,
+    PROMISE_TRANSFERRING,
+    PROMISE_FORCED
+};
+
+// computes a promise's value from its state, in the environment it was made in
+typedef lispvalue*(*lispthunk)(lispvm*, lispenv*, lispvalue*);
+
+// a value computed the first time it is forced and remembered after that, shared by every copy of a promise value,
+// lazy sequences are promises of either an empty q_expression or a q_expression of a value and the promise of the rest
+typedef struct lisppromise
+{
+    _Atomic(int64_t) refs;
+    atomic_int state;
+
+    // identifies the thread forcing the promise, NULL until one claims it
+    _Atomic(void*) owner;
+
+    // what to compute, freed once it has been, the environment is NULL for thunks that do not evaluate code
+    lispthunk thunk;
+    lispvalue* arguments;
+    lispenv* env;
+
+    lispvalue* value;
+} lisppromise;
+
+// makes a promise to call "thunk" with "arguments", which it takes ownership of,
+// capturing "le" if it is not NULL
+lisppromise* lisppromise_new(lispenv* le, lispthunk thunk, lispvalue* arguments);
+
+// makes a promise to evaluate a copy of "expression" in "le"
+lisppromise* lisppromise_delay(lispenv* le, lispvalue* expression);
+
+// deleting the last copy of a promise also deletes the rest of a lazy sequence no one else holds,
+// one cell at a time rather than recursively
+void lisppromise_delete(lisppromise* p);
+
+// like "lispvalue_transfer" for promises, a promise that has not been forced yet is forced
+// in the global environment of whichever virtual machine forces the copy,
+// one being forced on another thread is waited for
+lisppromise* lisppromise_transfer(lisppromise* p);
+
+// computes the promise's value if no one has yet and returns a copy of it
+lispvalue* lisppromise_force(lispvm* vm, lisppromise* p);
+
+// like "lisppromise_force" for promise values, other values are copied as they are
+lispvalue* lispvalue_force(lispvm* vm, lispvalue* lv);
+
+// lazy sequences of the numbers from "start" in steps of "step", up to but not including "end" if "bounded",
+// and of "function" applied to each value of "sequence"
+lisppromise* lisppromise_range(int64_t start, int64_t end, int64_t step, int bounded);
+lisppromise* lisppromise_map(lispenv* le, lispvalue* function, lispvalue* sequence);
+
+// the first "count" values of a lazy sequence, or fewer if it ends first
+lispvalue* lisppromise_take(lispvm* vm, lispvalue* sequence, int64_t count);
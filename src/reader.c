@@ -1,5 +1,15 @@
+// for mmap and friends
+#define _POSIX_C_SOURCE 200809L
+
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "constdest.h"
 
@@ -7,29 +17,40 @@
 
 lispvalue* lispvalue_read(mpc_ast_t* ast)
 {
-    // if a symbol or a number is encountered return the appropriate type
-    if (strstr(ast->tag, NUMBER_STR)) return lispvalue_read_number(ast);
-    else if (strstr(ast->tag, SYMBOL_STR)) return lispvalue_symbol(ast->contents);
+    lispvalue* lv;
 
-    lispvalue* lv = NULL;
-
-    // if root (>) or s_expression is encountered then create an empty list
-    if (!strcmp(ast->tag, ">") || strstr(ast->tag, SEXPRESSION_STR))   
-    lv = lispvalue_sexpression();
+    // if a symbol or a number is encountered return the appropriate type,
+    // the root (>) has no id and becomes an s_expression like an s_expression does
+    switch (ast->tag_id)
+    {
+        case LISPVALUE_TAG_NUMBER: return lispvalue_read_number(ast);
+        case LISPVALUE_TAG_SYMBOL: return lispvalue_symbol(ast->contents);
+        case LISPVALUE_TAG_QEXPRESSION: lv = lispvalue_qexpression(); break;
+        default: lv = lispvalue_sexpression(); break;
+    }
 
-    else if (strstr(ast->tag, QEXPRESSION_STR)) lv = lispvalue_qexpression();
+    // then fill this list with any valid expression contained within, skipping brackets and anchors,
+    // there are at most as many as the node has children so the cells are allocated once
+    if (ast->children_num) lv->cells = malloc(sizeof(lispvalue*) * ast->children_num);
 
-    // then fill this list with any valid expression contained within
     for (int i = 0; i < ast->children_num; i++)
     {
-        if (!strcmp(ast->children[i]->contents, "(")
-        || !strcmp(ast->children[i]->contents, ")")
-        || !strcmp(ast->children[i]->contents, "{")
-        || !strcmp(ast->children[i]->contents, "}")
-        || !strcmp(ast->children[i]->tag, "regex"))
-        continue;
+        switch (ast->children[i]->tag_id)
+        {
+            case LISPVALUE_TAG_NUMBER:
+            case LISPVALUE_TAG_SYMBOL:
+            case LISPVALUE_TAG_SEXPRESSION:
+            case LISPVALUE_TAG_QEXPRESSION:
+            lv->cells[lv->cell_count++] = lispvalue_read(ast->children[i]);
+            break;
+        }
+    }
 
-        lv = lispvalue_add(lv, lispvalue_read(ast->children[i]));
+    // an empty list keeps no cells, like one that was never added to
+    if (!lv->cell_count)
+    {
+        free(lv->cells);
+        lv->cells = NULL;
     }
 
     return lv;
@@ -40,4 +61,265 @@ lispvalue* lispvalue_read_number(mpc_ast_t* ast)
     errno = 0;
     int64_t number = strtol(ast->contents, NULL, 10);
     return (errno != ERANGE) ? lispvalue_number(number) : lispvalue_error("cannot read number");
-}
\ No newline at end of file
+}
+
+mpc_val_t* lispvalue_apply_number(mpc_val_t* x)
+{
+    errno = 0;
+    int64_t number = strtol(x, NULL, 10);
+    lispvalue* lv = (errno != ERANGE) ? lispvalue_number(number) : lispvalue_error("cannot read number");
+
+    free(x);
+    return lv;
+}
+
+mpc_val_t* lispvalue_apply_symbol(mpc_val_t* x)
+{
+    lispvalue* lv = lispvalue_symbol(x);
+
+    free(x);
+    return lv;
+}
+
+// the expressions a repetition matched become the cells of the list as they are, in one allocation
+static lispvalue* lispvalue_fold_list(lispvalue* lv, int n, mpc_val_t** xs)
+{
+    if (n)
+    {
+        lv->cells = malloc(sizeof(lispvalue*) * n);
+        memcpy(lv->cells, xs, sizeof(lispvalue*) * n);
+        lv->cell_count = n;
+    }
+
+    return lv;
+}
+
+mpc_val_t* lispvalue_fold_sexpression(int n, mpc_val_t** xs)
+{
+    return lispvalue_fold_list(lispvalue_sexpression(), n, xs);
+}
+
+mpc_val_t* lispvalue_fold_qexpression(int n, mpc_val_t** xs)
+{
+    return lispvalue_fold_list(lispvalue_qexpression(), n, xs);
+}
+
+void lispvalue_dtor(mpc_val_t* x)
+{
+    lispvalue_delete(x);
+}
+
+// an expression the reader has opened but not yet closed, its cells grow geometrically while it is read
+typedef struct readerframe
+{
+    lispvalue* list;
+    int64_t capacity;
+    char close;
+    size_t start;
+} readerframe;
+
+// characters symbols are made of, the same as the grammar's symbol rule
+static int reader_is_symbol(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || (c && strchr("_+-*/\\=<>!&%", c));
+}
+
+static int reader_is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static void reader_add(readerframe* frame, lispvalue* lv)
+{
+    lispvalue* list = frame->list;
+
+    if (list->cell_count == frame->capacity)
+    {
+        frame->capacity = frame->capacity ? frame->capacity * 2 : 4;
+        list->cells = realloc(list->cells, sizeof(lispvalue*) * frame->capacity);
+    }
+
+    list->cells[list->cell_count++] = lv;
+}
+
+// an error at "position", with its line and column worked out only now that they are needed
+static lispvalue* reader_error(char* filename, char* source, size_t position, char* message, char c)
+{
+    int line = 1, column = 1;
+
+    for (size_t i = 0; i < position; i++)
+    {
+        if (source[i] == '\n') { line++; column = 1; }
+        else column++;
+    }
+
+    if (c) return lispvalue_error("%s:%i:%i: error: %s '%c'", filename, line, column, message, c);
+    return lispvalue_error("%s:%i:%i: error: %s", filename, line, column, message);
+}
+
+// a number is an optional minus sign followed by digits, like the grammar's number rule
+static lispvalue* reader_number(char* source, size_t* position, size_t length)
+{
+    size_t i = *position;
+    int negative = source[i] == '-';
+    if (negative) i++;
+
+    uint64_t magnitude = 0;
+    int overflow = 0;
+
+    for (; i < length && source[i] >= '0' && source[i] <= '9'; i++)
+    {
+        int digit = source[i] - '0';
+        if (magnitude > ((uint64_t)INT64_MAX + negative - digit) / 10) overflow = 1;
+        else magnitude = magnitude * 10 + digit;
+    }
+
+    *position = i;
+
+    if (overflow) return lispvalue_error("cannot read number");
+    return lispvalue_number(negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude);
+}
+
+static lispvalue* reader_symbol(char* source, size_t* position, size_t length)
+{
+    size_t start = *position, i = start;
+    while (i < length && reader_is_symbol(source[i])) i++;
+    *position = i;
+
+    // the source is not null-terminated where the symbol ends, so its name is copied straight from the slice
+    return lispvalue_symbol_length(source + start, i - start);
+}
+
+lispvalue* lispvalue_read_source(char* filename, char* source, size_t length)
+{
+    // nested expressions are kept on a stack of their own rather than the C stack, so deep nesting cannot overflow it
+    int64_t depth = 0, frame_capacity = 16;
+    readerframe* frames = malloc(sizeof(readerframe) * frame_capacity);
+    frames[0] = (readerframe){ lispvalue_sexpression(), 0, '\0', 0 };
+
+    lispvalue* error = NULL;
+    size_t i = 0;
+
+    while (!error)
+    {
+        while (i < length && reader_is_space(source[i])) i++;
+
+        if (i == length)
+        {
+            if (depth) error = reader_error(filename, source, i, "expected closing", frames[depth].close);
+            break;
+        }
+
+        char c = source[i];
+
+        if (c == '(' || c == '{')
+        {
+            if (++depth == frame_capacity)
+            {
+                frame_capacity *= 2;
+                frames = realloc(frames, sizeof(readerframe) * frame_capacity);
+            }
+
+            lispvalue* list = c == '(' ? lispvalue_sexpression() : lispvalue_qexpression();
+            frames[depth] = (readerframe){ list, 0, c == '(' ? ')' : '}', i++ };
+        }
+
+        else if (c == ')' || c == '}')
+        {
+            if (!depth || frames[depth].close != c)
+            {
+                error = reader_error(filename, source, i, "unexpected", c);
+                break;
+            }
+
+            // give the cells back their exact size, the rest of the interpreter grows them one at a time
+            lispvalue* list = frames[depth--].list;
+            if (list->cell_count) list->cells = realloc(list->cells, sizeof(lispvalue*) * list->cell_count);
+
+            reader_add(&frames[depth], list);
+            i++;
+        }
+
+        // numbers are tried before symbols, so "-1" is a number and "-" or "-x" are symbols
+        else if ((c >= '0' && c <= '9') || (c == '-' && i + 1 < length && source[i + 1] >= '0' && source[i + 1] <= '9'))
+            reader_add(&frames[depth], reader_number(source, &i, length));
+
+        else if (reader_is_symbol(c)) reader_add(&frames[depth], reader_symbol(source, &i, length));
+
+        else error = reader_error(filename, source, i, "unexpected character", c);
+    }
+
+    // an error leaves every open expression behind, the outermost owns the rest once they are added to it
+    if (error)
+    {
+        for (; depth > 0; depth--) reader_add(&frames[depth - 1], frames[depth].list);
+        lispvalue_delete(frames[0].list);
+        free(frames);
+
+        return error;
+    }
+
+    lispvalue* program = frames[0].list;
+    if (program->cell_count) program->cells = realloc(program->cells, sizeof(lispvalue*) * program->cell_count);
+    free(frames);
+
+    return program;
+}
+
+int lispsource_open(lispsource* source, char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+
+    // regular files are mapped and read in place, so their contents are never copied
+    struct stat st;
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            close(fd);
+            *source = (lispsource){ data, st.st_size, 1 };
+            return 1;
+        }
+    }
+
+    // anything else, like a pipe, is read whole into a buffer that grows as it goes
+    size_t length = 0, capacity = 1 << 16;
+    char* data = malloc(capacity);
+
+    for (ssize_t n; (n = read(fd, data + length, capacity - length)) > 0;)
+    {
+        length += n;
+
+        if (length == capacity)
+        {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+
+    close(fd);
+    *source = (lispsource){ data, length, 0 };
+    return 1;
+}
+
+void lispsource_close(lispsource* source)
+{
+    if (source->mapped) munmap(source->data, source->length);
+    else free(source->data);
+}
+
+lispvalue* lispvalue_read_file(char* filename)
+{
+    lispsource source;
+    if (!lispsource_open(&source, filename)) return lispvalue_error("%s: error: cannot open file", filename);
+
+    lispvalue* program = lispvalue_read_source(filename, source.data, source.length);
+    lispsource_close(&source);
+
+    return program;
+}
@@ -1,8 +1,53 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "mpc/mpc.h"
 
 #include "definitions.h"
 
+// ids given to the rules of the mpc grammar, which the syntax tree's nodes carry in their "tag_id",
+// nodes without one are the root or punctuation and anchors
+enum LISPVALUE_TAG
+{
+    LISPVALUE_TAG_NONE = 0,
+    LISPVALUE_TAG_NUMBER,
+    LISPVALUE_TAG_SYMBOL,
+    LISPVALUE_TAG_SEXPRESSION,
+    LISPVALUE_TAG_QEXPRESSION,
+    LISPVALUE_TAG_EXPRESSION,
+    LISPVALUE_TAG_PROGRAM
+};
+
+// functions to turn an mpc syntax tree into lisp values, for the mpc reader
 lispvalue* lispvalue_read(mpc_ast_t* ast);
-lispvalue* lispvalue_read_number(mpc_ast_t* ast);
\ No newline at end of file
+lispvalue* lispvalue_read_number(mpc_ast_t* ast);
+
+// callbacks for mpc parsers that build lisp values while they parse, without a syntax tree,
+// numbers and symbols are applied to the text their regex matched, lists are folded from the expressions
+// a repetition matched, and partly built values are deleted with "lispvalue_dtor" when a parser backtracks
+mpc_val_t* lispvalue_apply_number(mpc_val_t* x);
+mpc_val_t* lispvalue_apply_symbol(mpc_val_t* x);
+mpc_val_t* lispvalue_fold_sexpression(int n, mpc_val_t** xs);
+mpc_val_t* lispvalue_fold_qexpression(int n, mpc_val_t** xs);
+void lispvalue_dtor(mpc_val_t* x);
+
+// reads a program of "length" bytes from "source" in a single pass, without building a syntax tree,
+// into an s_expression of its expressions, or an error value saying where it stopped making sense,
+// "filename" only appears in errors
+lispvalue* lispvalue_read_source(char* filename, char* source, size_t length);
+
+// a file's contents, mapped into memory where it is a regular file and read into a buffer otherwise
+typedef struct lispsource
+{
+    char* data;
+    size_t length;
+    int mapped;
+} lispsource;
+
+// functions to open a file's contents, returning 0 if it cannot be opened, and to release them again
+int lispsource_open(lispsource* source, char* filename);
+void lispsource_close(lispsource* source);
+
+// like "lispvalue_read_source" but reads the program from a file, in place when it can be mapped
+lispvalue* lispvalue_read_file(char* filename);
@@ -0,0 +1,53 @@
+#pragma once
+
+// checks shared by the tests, each test is a program linked against liblispy (see the README)
+// that prints the checks which failed and exits with their number
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../lispy.h"
+
+static int check_failures = 0;
+
+#define CHECK(condition, ...)                                                   \
+do                                                                              \
+{                                                                               \
+    if (!(condition))                                                           \
+    {                                                                           \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);                         \
+        fprintf(stderr, __VA_ARGS__);                                           \
+        fprintf(stderr, "\n");                                                  \
+        check_failures++;                                                       \
+    }                                                                           \
+} while (0)
+
+// evaluates "source" and checks that it gives the number "expected"
+#define CHECK_NUMBER(vm, source, expected)                                      \
+do                                                                              \
+{                                                                               \
+    lispvalue* check_lv = lispvm_eval_string(vm, source);                       \
+    CHECK(lispvalue_type(check_lv) == LISPVALUE_NUMBER                          \
+    && lispvalue_as_number(check_lv) == (expected),                             \
+    "%s: expected %lli, got %s", source, (long long)(expected),                 \
+    lispvalue_to_string(check_lv));                                             \
+    lispvalue_delete(check_lv);                                                 \
+} while (0)
+
+// evaluates "source" and checks that it gives an error
+#define CHECK_ERROR(vm, source)                                                 \
+do                                                                              \
+{                                                                               \
+    lispvalue* check_lv = lispvm_eval_string(vm, source);                       \
+    CHECK(lispvalue_is_error(check_lv), "%s: expected an error, got %s",        \
+    source, lispvalue_to_string(check_lv));                                     \
+    lispvalue_delete(check_lv);                                                 \
+} while (0)
+
+static int check_done(char* name)
+{
+    if (check_failures) fprintf(stderr, "%s: %d checks failed\n", name, check_failures);
+    else printf("%s: passed\n", name);
+
+    return check_failures;
+}
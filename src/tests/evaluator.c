@@ -0,0 +1,38 @@
+// checks the order expressions are evaluated in
+
+#include "check.h"
+
+int main()
+{
+    lispvm* vm = lispvm_new();
+
+    // the head of an expression is evaluated before its arguments, which are evaluated left to right
+    CHECK_NUMBER(vm, "((do (define {x} 5) +) x 1)", 6);
+    CHECK_NUMBER(vm, "(+ (do (define {y} 2) y) (* y 10))", 22);
+
+    // a definition is visible to the expressions after it
+    lispvalue_delete(lispvm_eval_string(vm, "(define {z} 5)\n(+ z 1)"));
+    CHECK_NUMBER(vm, "z", 5);
+
+    // arguments are not evaluated once the head is an error
+    CHECK_ERROR(vm, "(undefined (define {w} 1))");
+    CHECK_ERROR(vm, "w");
+
+    // lambda parameters and "let" bindings named like special forms shadow them inside
+    CHECK_NUMBER(vm, "((\\ {if} {if 1 2}) +)", 3);
+    CHECK_NUMBER(vm, "(let {and (\\ {a b} {- a b})} (and 5 3))", 2);
+    CHECK_NUMBER(vm, "(if (and 5 0) 1 7)", 7);
+
+    lispvm_delete(vm);
+
+    // a definition named like a special form shadows it from then on, even where it was used before
+    vm = lispvm_new();
+
+    CHECK_NUMBER(vm, "(do 1 2)", 2);
+    CHECK_NUMBER(vm, "(define {do} (\\ {x} {* x 2}))\n(do 21)", 42);
+    CHECK_NUMBER(vm, "(if 1 5 6)", 5);
+
+    lispvm_delete(vm);
+
+    return check_done("evaluator");
+}
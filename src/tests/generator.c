@@ -0,0 +1,43 @@
+// checks recursing deeply inside a generator, whose stack is much smaller than the thread's,
+// and that generators are not handed to or resumed from other threads
+
+#include "check.h"
+
+int main()
+{
+    lispvm* vm = lispvm_new();
+
+    CHECK_NUMBER(vm, "(define {down} (\\ {n} {if (== n 0) {0} {+ 1 (down (- n 1))}}))\n(down 1000)", 1000);
+    CHECK_NUMBER(vm, "(next (generator (\\ {n} {yield (down n)}) 200))", 200);
+
+    // recursing further than the stack allows fails with an error instead of overflowing it
+    CHECK_ERROR(vm, "(next (generator (\\ {n} {yield (down n)}) 1000000))");
+
+    // the error ends the generator, and the thread's stack is unaffected
+    CHECK_ERROR(vm, "(define {g} (generator (\\ {n} {yield (down n)}) 1000000))\n(next g)");
+    CHECK_ERROR(vm, "(next g)");
+    CHECK_NUMBER(vm, "(done g)", 1);
+    CHECK_NUMBER(vm, "(down 1000)", 1000);
+
+    // generators stay on the thread that made them
+    CHECK_ERROR(vm, "(send (channel 1) (generator (\\ {} {yield 1})))");
+    CHECK_ERROR(vm, "(wait (spawn (\\ {h} {next h}) (generator (\\ {} {yield 1}))))");
+    CHECK_ERROR(vm, "(await (future (\\ {h} {next h}) (generator (\\ {} {yield 1}))))");
+    CHECK_ERROR(vm, "(define {h} (generator (\\ {} {yield 1})))\n(wait (spawn (\\ {} {next h})))");
+    CHECK_NUMBER(vm, "(next h)", 1);
+
+    // parallel builtins share the globals but run on the pool, so they cannot resume a generator bound there
+    CHECK_NUMBER(vm, "(workers 4)", 4);
+    CHECK_ERROR(vm, "(define {n} (generator (\\ {} {dotimes {i 100} (yield i)})))\n"
+    "(pmap (\\ {x} {next n}) {1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16} 1)");
+    CHECK_ERROR(vm, "(pmap (\\ {x} {done n}) {1 2 3 4} 1)");
+    CHECK_ERROR(vm, "(pmap (\\ {x} {take 2 n}) {1 2 3 4} 1)");
+    CHECK_NUMBER(vm, "(+ (next n) (next n))", 1);
+
+    // generators made inside a parallel function belong to the worker running it
+    CHECK_NUMBER(vm, "(fold + 0 (pmap (\\ {x} {next (generator (\\ {} {yield (* x x)}))}) {1 2 3 4} 1))", 30);
+
+    lispvm_delete(vm);
+
+    return check_done("generator");
+}
@@ -0,0 +1,28 @@
+// checks which values can be handed to other isolates and futures
+
+#include "check.h"
+
+int main()
+{
+    lispvm* vm = lispvm_new();
+
+    CHECK_NUMBER(vm, "(define {c} (channel 4))\n(send c 5)\n(recv c)", 5);
+    CHECK_NUMBER(vm, "(send c {1 2 3})\n(len (recv c))", 3);
+    CHECK_NUMBER(vm, "(send c (\\ {x} {* x 2}))\n((recv c) 21)", 42);
+    CHECK_NUMBER(vm, "(send c (delay (+ 1 2)))\n(force (recv c))", 3);
+    CHECK_NUMBER(vm, "(wait (spawn (\\ {d} {recv d}) (do (send c 7) c)))", 7);
+    CHECK_NUMBER(vm, "(wait (spawn (\\ {i} {wait i}) (spawn (\\ {} {8}))))", 8);
+
+    // futures and generators belong to the virtual machine that made them
+    CHECK_ERROR(vm, "(send c (future (\\ {} {1})))");
+    CHECK_ERROR(vm, "(send c (list 1 (future (\\ {} {1}))))");
+    CHECK_ERROR(vm, "(wait (spawn (\\ {f} {await f}) (future (\\ {} {1}))))");
+    CHECK_ERROR(vm, "(await (future (\\ {f} {await f}) (future (\\ {} {1}))))");
+    CHECK_ERROR(vm, "(define {f} (future (\\ {} {9})))\n(wait (spawn (\\ {} {await f})))");
+    CHECK_ERROR(vm, "(wait (spawn (\\ {} {future (\\ {} {1})})))");
+    CHECK_NUMBER(vm, "(await f)", 9);
+
+    lispvm_delete(vm);
+
+    return check_done("isolate");
+}
@@ -0,0 +1,47 @@
+// checks evaluating programs of several expressions through the embedding interface
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+
+#include "check.h"
+
+int main()
+{
+    lispvm* vm = lispvm_new();
+
+    // expressions are evaluated in order and the last one is the result
+    CHECK_NUMBER(vm, "(define {x} 41) (+ x 1)", 42);
+    CHECK_NUMBER(vm, "(define {y} 2)(define {z} 3)(+ y z)", 5);
+    CHECK_NUMBER(vm, "7", 7);
+
+    // evaluation stops at the first error
+    CHECK_ERROR(vm, "(define {a} 1) (undefined) (define {b} 2)");
+    CHECK_NUMBER(vm, "a", 1);
+    CHECK_ERROR(vm, "b");
+
+    // an empty program is an empty expression
+    lispvalue* lv = lispvm_eval_string(vm, "");
+    CHECK(lispvalue_type(lv) == LISPVALUE_SEXPRESSION && lispvalue_length(lv) == 0,
+    "empty program: got %s", lispvalue_to_string(lv));
+    lispvalue_delete(lv);
+
+    // files are evaluated the same way
+    char path[] = "/tmp/lispy-test-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0, "cannot create %s", path);
+
+    dprintf(fd, "(define {double} (\\ {n} {* n 2}))\n(define {c} 10)\n(double c)\n");
+    close(fd);
+
+    lv = lispvm_eval_file(vm, path);
+    CHECK(lispvalue_as_number(lv) == 20, "%s: expected 20, got %s", path, lispvalue_to_string(lv));
+    lispvalue_delete(lv);
+    unlink(path);
+
+    CHECK_NUMBER(vm, "(double 4)", 8);
+
+    lispvm_delete(vm);
+
+    return check_done("lispy");
+}
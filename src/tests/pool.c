@@ -0,0 +1,47 @@
+// checks resizing the shared pool while parallel builtins and futures are running on it
+
+#include "check.h"
+
+int main()
+{
+    lispvm* vm = lispvm_new();
+
+    CHECK_NUMBER(vm, "(workers 2)", 2);
+    CHECK_NUMBER(vm, "(define {xs} {1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16})\n(fold + 0 (pmap (\\ {x} {* x x}) xs 1))", 1496);
+
+    // resizing from inside a parallel function swaps in another pool for later calls
+    CHECK_NUMBER(vm, "(fold + 0 (pmap (\\ {x} {do (workers (+ 1 (% x 3))) (* x x)}) xs 1))", 1496);
+
+    // isolates keep running parallel functions while this thread resizes the pool under them
+    CHECK_NUMBER(vm, "(define {run} (\\ {} {do (define {total} 0) "
+    "(dotimes {i 1000} (define {total} (+ total (fold + 0 (pmap (\\ {x} {* x 2}) xs 1))))) total}))\n"
+    "(define {a} (spawn run))\n(define {b} (spawn run))\n7", 7);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        char resize[32];
+        snprintf(resize, sizeof(resize), "(workers %d)", 1 + i % 4);
+        CHECK_NUMBER(vm, resize, 1 + i % 4);
+    }
+
+    CHECK_NUMBER(vm, "(+ (wait a) (wait b))", 2 * 1000 * 272);
+
+    // a future waiting on this thread keeps its pool while the pool is resized, and this thread does not wait for it
+    CHECK_NUMBER(vm, "(define {c} (channel 1))\n(define {f} (future (\\ {} {+ (recv c) 1})))\n(workers 3)", 3);
+    CHECK_NUMBER(vm, "(workers 1)", 1);
+    CHECK_NUMBER(vm, "(define {g} (future (\\ {x} {* x x}) 6))\n(workers 2)", 2);
+    CHECK_NUMBER(vm, "(do (send c 41) (+ (await f) (await g)))", 78);
+
+    // a future started from a parallel function waits for a worker of its own instead of running
+    // inside the fork it was started from, where blocking on this thread would never return
+    CHECK_NUMBER(vm, "(workers 1)", 1);
+    CHECK_NUMBER(vm, "(define {fs} (pmap (\\ {x} {if (== x 1) {future (\\ {} {+ (recv c) 1})} {x}}) {1 2 3 4} 1))\n"
+    "(len fs)", 4);
+    CHECK_NUMBER(vm, "(do (send c 8) (await (eval (head fs))))", 9);
+
+    CHECK_NUMBER(vm, "(workers 0)", 1);
+
+    lispvm_delete(vm);
+
+    return check_done("pool");
+}
@@ -0,0 +1,31 @@
+// checks promises forced and transferred to other isolates from several threads at once
+
+#include "check.h"
+
+int main()
+{
+    lispvm* vm = lispvm_new();
+    lispvalue_delete(lispvm_eval_string(vm, "(workers 4)"));
+
+    CHECK_NUMBER(vm, "(define {cs} (channel 1000))\n(define {cd} (channel 1000))\n(define {p} (delay (+ 1 2)))\n(force p)", 3);
+    CHECK_ERROR(vm, "(define {q} (delay (force q)))\n(force q)");
+
+    // every worker sends the same promises while others force them, each copy is forced on its own
+    for (int i = 0; i < 200; i++)
+    {
+        CHECK_NUMBER(vm, "(define {s} (lazy-map (\\ {x} {* x x}) (lazy-range 0)))\n"
+        "(define {d} (delay (+ 40 2)))\n"
+        "(fold + 0 (pmap (\\ {x} {do (send cs s) (send cd d) (+ (force d) (fold + 0 (take 8 s)))}) "
+        "{1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16} 1))", 16 * (42 + 140));
+
+        for (int j = 0; j < 16; j++)
+        {
+            CHECK_NUMBER(vm, "(fold + 0 (take 8 (recv cs)))", 140);
+            CHECK_NUMBER(vm, "(force (recv cd))", 42);
+        }
+    }
+
+    lispvm_delete(vm);
+
+    return check_done("promise");
+}
@@ -0,0 +1,63 @@
+// checks that the mpc reader fails on deeply nested malformed input in time linear in its length
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+
+static double now()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// reads and parses "depth" unclosed parentheses, which used to take time exponential in the depth
+static void check_unclosed(lispvm* vm, int depth)
+{
+    char* source = malloc(depth + 1);
+    memset(source, '(', depth);
+    source[depth] = '\0';
+
+    double start = now();
+
+    lispvalue* lv = lispvm_read(vm, "<unclosed>", source);
+    CHECK(lispvalue_is_error(lv), "%d unclosed: expected an error, got %s", depth, lispvalue_to_string(lv));
+    lispvalue_delete(lv);
+
+    mpc_result_t result;
+    mpc_ast_arena_t* arena = mpc_ast_arena_new();
+
+    int parsed = lispvm_parse(vm, "<unclosed>", source, arena, &result);
+    CHECK(!parsed, "%d unclosed: expected a parse error", depth);
+    if (!parsed) mpc_err_delete(result.error);
+
+    mpc_ast_arena_delete(arena);
+
+    double elapsed = now() - start;
+    CHECK(elapsed < 1.0, "%d unclosed: took %.3fs", depth, elapsed);
+
+    free(source);
+}
+
+int main()
+{
+    setenv("LISPY_READER", "mpc", 1);
+    lispvm* vm = lispvm_new();
+
+    check_unclosed(vm, 24);
+    check_unclosed(vm, 64);
+    check_unclosed(vm, 10000);
+
+    // the error is the same one trying every alternative gives
+    lispvalue* lv = lispvm_read(vm, "<unclosed>", "((");
+    CHECK(lispvalue_is_error(lv) && strstr(lispvalue_as_string(lv), "'(', '{' or ')' at end of input"),
+    "((: got %s", lispvalue_to_string(lv));
+    lispvalue_delete(lv);
+
+    lispvm_delete(vm);
+
+    return check_done("reader");
+}
@@ -0,0 +1,50 @@
+// builds the mpc grammar of the language and prints grammar.c, the image of it "lispvm_parse" loads
+// instead of parsing the grammar, run it again whenever the grammar changes
+//
+// usage: save_grammar > grammar.c
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../mpc/mpc.h"
+#include "../grammar.h"
+
+int main()
+{
+    mpc_parser_t* program         = mpc_new(PROGRAM_STR);
+    mpc_parser_t* expression      = mpc_new(EXPRESSION_STR);
+    mpc_parser_t* s_expression    = mpc_new(SEXPRESSION_STR);
+    mpc_parser_t* q_expression    = mpc_new(QEXPRESSION_STR);
+    mpc_parser_t* symbol          = mpc_new(SYMBOL_STR);
+    mpc_parser_t* number          = mpc_new(NUMBER_STR);
+
+    unsigned char* image;
+    size_t length;
+
+    mpc_err_t* error = mpca_lang_save(MPCA_LANG_DEFAULT, LISPVM_GRAMMAR, &image, &length,
+    program, expression, s_expression, q_expression, symbol, number);
+
+    if (error)
+    {
+        mpc_err_print_to(error, stderr);
+        mpc_err_delete(error);
+        return 1;
+    }
+
+    printf("// generated by tools/save_grammar.c from the grammar in grammar.h, do not edit\n\n");
+    printf("#include \"grammar.h\"\n\n");
+    printf("const unsigned char lispvm_grammar_image[] =\n{");
+
+    for (size_t i = 0; i < length; i++)
+    {
+        printf(i % 12 ? " 0x%02x," : "\n    0x%02x,", image[i]);
+    }
+
+    printf("\n};\n\n");
+    printf("const size_t lispvm_grammar_image_length = sizeof(lispvm_grammar_image);\n");
+
+    free(image);
+    mpc_cleanup(6, number, symbol, q_expression, s_expression, expression, program);
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "constdest.h"
+#include "evaluator.h"
+#include "grammar.h"
+#include "reader.h"
+
+#include "vm.h"
+
+lispvm* lispvm_new()
+{
+    lispvm* vm = malloc(sizeof(lispvm));
+
+    // the grammar is only built if the mpc reader is used
+    char* reader = getenv("LISPY_READER");
+    vm->reader = reader && !strcmp(reader, "mpc") ? LISPVM_READER_MPC : LISPVM_READER_NATIVE;
+    vm->parsers.program = NULL;
+    vm->value_parsers.program = NULL;
+
+    vm->env = lispenv_new();
+    lispenv_add_builtins(vm->env);
+
+    atomic_init(&vm->stats.reads, 0);
+    atomic_init(&vm->stats.evaluations, 0);
+    atomic_init(&vm->stats.errors, 0);
+
+    return vm;
+}
+
+void lispvm_delete(lispvm* vm)
+{
+    lispenv_delete(vm->env);
+
+    // clean up the parsers
+    lispparsers* grammars[] = { &vm->parsers, &vm->value_parsers };
+
+    for (int i = 0; i < 2; i++)
+    {
+        lispparsers* parsers = grammars[i];
+
+        if (parsers->program)
+        mpc_cleanup(6, parsers->number, parsers->symbol, parsers->q_expression,
+        parsers->s_expression, parsers->expression, parsers->program);
+    }
+
+    free(vm);
+}
+
+lisppool* lispvm_pool(lispvm* vm)
+{
+    // looked up every time rather than kept, another virtual machine may have resized the shared pool,
+    // the old one lives on for as long as anyone holds a reference to it
+    return lisppool_shared();
+}
+
+// optimises a grammar once all of its parsers are defined, which among other things
+// lets each expression pick the alternative to parse from its first character instead of trying them in turn
+static void lispvm_optimise_parsers(lispparsers* p)
+{
+    mpc_parser_t* parsers[] = { p->program, p->expression, p->s_expression, p->q_expression, p->symbol, p->number };
+
+    for (int i = 0; i < 6; i++) mpc_optimise(parsers[i]);
+}
+
+static void lispvm_build_parsers(lispvm* vm)
+{
+    // create some parsers, with ids the syntax tree's nodes carry so the reader can switch on them
+    vm->parsers.program         = mpc_tag_id(mpc_new(PROGRAM_STR), LISPVALUE_TAG_PROGRAM);
+    vm->parsers.expression      = mpc_tag_id(mpc_new(EXPRESSION_STR), LISPVALUE_TAG_EXPRESSION);
+    vm->parsers.s_expression    = mpc_tag_id(mpc_new(SEXPRESSION_STR), LISPVALUE_TAG_SEXPRESSION);
+    vm->parsers.q_expression    = mpc_tag_id(mpc_new(QEXPRESSION_STR), LISPVALUE_TAG_QEXPRESSION);
+    vm->parsers.symbol          = mpc_tag_id(mpc_new(SYMBOL_STR), LISPVALUE_TAG_SYMBOL);
+    vm->parsers.number          = mpc_tag_id(mpc_new(NUMBER_STR), LISPVALUE_TAG_NUMBER);
+
+    // define the grammar of the language from its image, which is already optimised,
+    // mpc parses the grammar instead if the image was saved from another one
+    mpca_lang_load(MPCA_LANG_DEFAULT, LISPVM_GRAMMAR, lispvm_grammar_image, lispvm_grammar_image_length,
+    vm->parsers.program, vm->parsers.expression, vm->parsers.s_expression,
+    vm->parsers.q_expression, vm->parsers.symbol, vm->parsers.number);
+}
+
+// a token of the value grammar, which skips the whitespace after it like the language grammar's tokens do
+static mpc_parser_t* lispvm_token(char c)
+{
+    return mpc_apply(mpc_tok(mpc_char(c)), mpcf_free);
+}
+
+// the same grammar as "lispvm_build_parsers", built from combinators whose callbacks turn what they match
+// into lisp values as they go, so no syntax tree is built, walked and freed
+static void lispvm_build_value_parsers(lispvm* vm)
+{
+    lispparsers* p = &vm->value_parsers;
+
+    p->program          = mpc_new(PROGRAM_STR);
+    p->expression       = mpc_new(EXPRESSION_STR);
+    p->s_expression     = mpc_new(SEXPRESSION_STR);
+    p->q_expression     = mpc_new(QEXPRESSION_STR);
+    p->symbol           = mpc_new(SYMBOL_STR);
+    p->number           = mpc_new(NUMBER_STR);
+
+    mpc_define(p->number, mpc_apply(mpc_tok(mpc_re("-?[0-9]+")), lispvalue_apply_number));
+    mpc_define(p->symbol, mpc_apply(mpc_tok(mpc_re("[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+")), lispvalue_apply_symbol));
+
+    mpc_define(p->s_expression, mpc_and(3, mpcf_snd,
+    lispvm_token('('), mpc_many(lispvalue_fold_sexpression, p->expression), lispvm_token(')'),
+    mpcf_dtor_null, lispvalue_dtor));
+
+    mpc_define(p->q_expression, mpc_and(3, mpcf_snd,
+    lispvm_token('{'), mpc_many(lispvalue_fold_qexpression, p->expression), lispvm_token('}'),
+    mpcf_dtor_null, lispvalue_dtor));
+
+    mpc_define(p->expression, mpc_or(4, p->number, p->symbol, p->s_expression, p->q_expression));
+
+    mpc_define(p->program, mpc_whole(mpc_stripl(mpc_many(lispvalue_fold_sexpression, p->expression)), lispvalue_dtor));
+
+    lispvm_optimise_parsers(p);
+}
+
+int lispvm_parse(lispvm* vm, char* filename, char* source, mpc_ast_arena_t* arena, mpc_result_t* result)
+{
+    if (!vm->parsers.program) lispvm_build_parsers(vm);
+
+    atomic_fetch_add_explicit(&vm->stats.reads, 1, memory_order_relaxed);
+
+    if (source) return mpc_nparse_arena(filename, source, strlen(source), vm->parsers.program, arena, result);
+
+    // files are parsed in place, mpc reports files that cannot be opened itself
+    lispsource contents;
+    if (!lispsource_open(&contents, filename)) return mpc_parse_contents(filename, vm->parsers.program, result);
+
+    int parsed = mpc_nparse_arena(filename, contents.data, contents.length, vm->parsers.program, arena, result);
+    lispsource_close(&contents);
+
+    return parsed;
+}
+
+lispvalue* lispvm_read(lispvm* vm, char* filename, char* source)
+{
+    if (vm->reader == LISPVM_READER_NATIVE)
+    {
+        atomic_fetch_add_explicit(&vm->stats.reads, 1, memory_order_relaxed);
+
+        if (source) return lispvalue_read_source(filename, source, strlen(source));
+        return lispvalue_read_file(filename);
+    }
+
+    if (!vm->value_parsers.program) lispvm_build_value_parsers(vm);
+
+    atomic_fetch_add_explicit(&vm->stats.reads, 1, memory_order_relaxed);
+
+    mpc_result_t result;
+    mpc_parser_t* program = vm->value_parsers.program;
+    lispsource contents;
+    int parsed;
+
+    if (source) parsed = mpc_parse(filename, source, program, &result);
+
+    else
+    {
+        if (!lispsource_open(&contents, filename)) return lispvalue_error("%s: error: cannot open file", filename);
+
+        parsed = mpc_nparse(filename, contents.data, contents.length, program, &result);
+        lispsource_close(&contents);
+    }
+
+    if (!parsed)
+    {
+        char* message = mpc_err_string(result.error);
+
+        // mpc ends its messages with a newline, error values do not
+        size_t length = strlen(message);
+        if (length && message[length - 1] == '\n') message[length - 1] = '\0';
+
+        lispvalue* error = lispvalue_error("%s", message);
+
+        free(message);
+        mpc_err_delete(result.error);
+        return error;
+    }
+
+    return result.output;
+}
+
+lispvalue* lispvm_eval(lispvm* vm, lispvalue* lv)
+{
+    atomic_fetch_add_explicit(&vm->stats.evaluations, 1, memory_order_relaxed);
+
+    lispvalue* x = lispvalue_eval(vm, vm->env, lv);
+
+    if (x->type == LISPVALUE_ERROR)
+    atomic_fetch_add_explicit(&vm->stats.errors, 1, memory_order_relaxed);
+
+    return x;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "mpc/mpc.h"
+
+#include "definitions.h"
+#include "pool.h"
+
+// counters describing the work a virtual machine has done
+typedef struct lispstats
+{
+    atomic_llong reads;
+    atomic_llong evaluations;
+    atomic_llong errors;
+} lispstats;
+
+// which reader turns source text into lisp values, the mpc grammar is kept for compatibility
+enum LISPVM_READER
+{
+    LISPVM_READER_NATIVE = 0,
+    LISPVM_READER_MPC
+};
+
+// parsers making up the grammar of the language, only built once the mpc reader is used,
+// once into a syntax tree for "lispvm_parse" and once into lisp values directly for "lispvm_read"
+typedef struct lispparsers
+{
+    mpc_parser_t* program;
+    mpc_parser_t* expression;
+    mpc_parser_t* s_expression;
+    mpc_parser_t* q_expression;
+    mpc_parser_t* symbol;
+    mpc_parser_t* number;
+} lispparsers;
+
+// an interpreter instance owning its global environment, parsers and statistics,
+// nothing evaluation touches is process-global so several can run side by side, one per thread,
+// the work-stealing pool is the exception and is shared by every virtual machine
+typedef struct lispvm
+{
+    lispenv* env;
+    int8_t reader;
+    lispparsers parsers;
+    lispparsers value_parsers;
+    lispstats stats;
+} lispvm;
+
+// functions to construct and destruct virtual machines,
+// they read with the native reader unless the LISPY_READER environment variable is "mpc"
+lispvm* lispvm_new();
+void lispvm_delete(lispvm* vm);
+
+// a reference to the pool parallel builtins and futures run on, deleted with "lisppool_delete"
+// once the tasks handed to it have been waited for, its threads are only started on first use
+lisppool* lispvm_pool(lispvm* vm);
+
+// parses a file, or "source" if it is not NULL, with the virtual machine's mpc grammar,
+// the syntax tree is built in the arena and freed with it, and must not outlive the virtual machine
+int lispvm_parse(lispvm* vm, char* filename, char* source, mpc_ast_arena_t* arena, mpc_result_t* result);
+
+// reads a file, or "source" if it is not NULL, with the virtual machine's reader into an s_expression
+// of the program's expressions, or an error value if it cannot be read
+lispvalue* lispvm_read(lispvm* vm, char* filename, char* source);
+
+// evaluates a lisp value in the virtual machine's global environment and deletes it
+lispvalue* lispvm_eval(lispvm* vm, lispvalue* lv);